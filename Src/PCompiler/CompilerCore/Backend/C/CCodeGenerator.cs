@@ -927,17 +927,17 @@ namespace Plang.Compiler.Backend.C
                     break;
 
                 case CtorStmt ctorStmt:
-                    context.Write(
-                        output,
-                        $"PrtMkInterface(context, {context.GetDeclNumber(ctorStmt.Interface)}, {ctorStmt.Arguments.Count}");
-                    foreach (var pExpr in ctorStmt.Arguments)
+                    foreach (var arg in ctorStmt.Arguments.Select((pExpr, i) => new { pExpr, i }))
                     {
-                        Debug.Assert(pExpr is IVariableRef);
-                        var argVar = (IVariableRef)pExpr;
-                        context.Write(output, $", {GetVariableReference(function, argVar)}");
+                        Debug.Assert(arg.pExpr is IVariableRef);
+                        var argVar = (IVariableRef)arg.pExpr;
+                        context.WriteLine(
+                            output, $"{FunCallArgsArrayName}[{arg.i}] = {GetVariableReference(function, argVar)};");
                     }
 
-                    context.WriteLine(output, ");");
+                    context.WriteLine(
+                        output,
+                        $"PrtMkInterfaceEx(context, {context.GetDeclNumber(ctorStmt.Interface)}, {ctorStmt.Arguments.Count}, {FunCallArgsArrayName});");
                     WriteCleanupCheck(output, function);
                     break;
 
@@ -1157,19 +1157,19 @@ namespace Plang.Compiler.Backend.C
                     break;
 
                 case SendStmt sendStmt:
-                    context.Write(output, "PrtSendInternal(context, PrtGetMachine(context->process, ");
-                    WriteExpr(output, function, sendStmt.MachineExpr);
-                    context.Write(output, "), ");
-                    WriteExpr(output, function, sendStmt.Evt);
-                    context.Write(output, $", {sendStmt.Arguments.Count}");
-                    foreach (var sendArgExpr in sendStmt.Arguments)
+                    foreach (var arg in sendStmt.Arguments.Select((pExpr, i) => new { pExpr, i }))
                     {
-                        Debug.Assert(sendArgExpr is IVariableRef);
-                        var argVar = (IVariableRef)sendArgExpr;
-                        context.Write(output, $", {GetVariableReference(function, argVar)}");
+                        Debug.Assert(arg.pExpr is IVariableRef);
+                        var argVar = (IVariableRef)arg.pExpr;
+                        context.WriteLine(
+                            output, $"{FunCallArgsArrayName}[{arg.i}] = {GetVariableReference(function, argVar)};");
                     }
 
-                    context.WriteLine(output, ");");
+                    context.Write(output, "PrtSendInternalEx(context, PrtGetMachine(context->process, ");
+                    WriteExpr(output, function, sendStmt.MachineExpr);
+                    context.Write(output, "), ");
+                    WriteExpr(output, function, sendStmt.Evt);
+                    context.WriteLine(output, $", {sendStmt.Arguments.Count}, {FunCallArgsArrayName});");
 
                     Debug.Assert(sendStmt.Evt is IVariableRef);
                     var sendEventVar = (IVariableRef)sendStmt.Evt;
@@ -1393,17 +1393,14 @@ namespace Plang.Compiler.Backend.C
                     break;
 
                 case CtorExpr ctorExpr:
-                    context.Write(
-                        output,
-                        $"PrtCloneValue(PrtMkInterface(context, {context.GetDeclNumber(ctorExpr.Interface)}, {ctorExpr.Arguments.Count}");
-                    foreach (var pExpr in ctorExpr.Arguments)
+                    var ctorArgs = ctorExpr.Arguments.Cast<IVariableRef>().ToList();
+                    var ctorArgSetup = ctorArgs.Select((arg, i) =>
+                        $"({FunCallArgsArrayName}[{i}] = {GetVariableReference(function, arg)})");
+                    var ctorCall = new[]
                     {
-                        Debug.Assert(pExpr is IVariableRef);
-                        var argVar = (IVariableRef)pExpr;
-                        context.Write(output, $", {GetVariableReference(function, argVar)}");
-                    }
-
-                    context.Write(output, ")->id)");
+                        $"PrtCloneValue(PrtMkInterfaceEx(context, {context.GetDeclNumber(ctorExpr.Interface)}, {ctorExpr.Arguments.Count}, {FunCallArgsArrayName})->id)"
+                    };
+                    context.Write(output, $"({string.Join(", ", ctorArgSetup.Concat(ctorCall))})");
                     break;
 
                 case DefaultExpr defaultExpr:
@@ -158,6 +158,24 @@ extern "C" {
 	*/
 	PRT_API void PRT_CALL_CONV PrtYieldThread(void);
 
+	/**
+	* Creates a helper thread running fn(arg).
+	* @param[in] fn The thread entry point.
+	* @param[in] arg Passed through to fn.
+	* @returns An opaque handle to pass to PrtJoinThread, or NULL if the
+	* platform cannot spawn helper threads, in which case the caller must do
+	* the work on the current thread.
+	* @see PrtJoinThread
+	*/
+	PRT_API void* PRT_CALL_CONV PrtCreateThread(_In_ void (PRT_CALL_CONV* fn)(void*), _In_ void* arg);
+
+	/**
+	* Waits for a thread created by PrtCreateThread to finish and releases its handle.
+	* @param[in] thread A handle returned by PrtCreateThread.
+	* @see PrtCreateThread
+	*/
+	PRT_API void PRT_CALL_CONV PrtJoinThread(_In_ void* thread);
+
 	/**
 	* Calls system-specific implementation of malloc.
 	* Fails eagerly if memory cannot be allocated.
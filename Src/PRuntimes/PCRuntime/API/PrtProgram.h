@@ -36,7 +36,7 @@ extern "C" {
 	{
 		PRT_UINT32 nEvents; /**< The number of events */
 		PRT_EVENTDECL** events; /**< The array of events */
-		PRT_UINT32* packedEvents; /**< The events packed into an array of ints */
+		PRT_UINT32* packedEvents; /**< The events packed into an array of ints; built at install time when NULL, or emitted precomputed by the generator */
 	} PRT_EVENTSETDECL;
 
 	/** Represents a P interface declaration */
@@ -115,6 +115,8 @@ extern "C" {
 		PRT_DODECL* dos; /**< The array of installed actions                     */
 		PRT_FUNDECL* entryFun; /**< The entry function in owner machine       */
 		PRT_FUNDECL* exitFun; /**< The exit function in owner machine        */
+		PRT_UINT32* transLookup; /**< Event index -> transition index (nTransitions if absent); built at install time when NULL, or emitted precomputed */
+		PRT_UINT32* doLookup; /**< Event index -> do index (nDos if absent); built at install time when NULL, or emitted precomputed */
 	} PRT_STATEDECL;
 
 	/** Represents a P machine declaration */
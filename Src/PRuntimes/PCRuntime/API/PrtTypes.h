@@ -261,6 +261,26 @@ extern "C" {
 	*/
 	PRT_API PRT_BOOLEAN PRT_CALL_CONV PrtIsSubtype(_In_ PRT_TYPE* subType, _In_ PRT_TYPE* supType);
 
+	/** Determines if two types are structurally equal. Interned types (see
+	* PrtInternType) compare with a single pointer comparison.
+	* @param[in] type1 The first type.
+	* @param[in] type2 The second type.
+	* @returns `true` if the types are equal; `false` otherwise.
+	*/
+	PRT_API PRT_BOOLEAN PRT_CALL_CONV PrtIsEqualType(_In_ PRT_TYPE* type1, _In_ PRT_TYPE* type2);
+
+	/** Returns the canonical representative of type from the intern table,
+	* recording type itself as the representative if no structurally equal type
+	* was interned before. The table does not take ownership of type. Two
+	* interned types are equal exactly when they are the same pointer.
+	* @param[in] type The type to intern; must stay alive while the program is installed.
+	* @returns The canonical type equal to type.
+	*/
+	PRT_API PRT_TYPE* PRT_CALL_CONV PrtInternType(_In_ PRT_TYPE* type);
+
+	/** Empties the type intern table; the interned types themselves are not freed. */
+	PRT_API void PRT_CALL_CONV PrtClearInternedTypes(void);
+
 	/** Performs a deep clone of type.
 	* @param[in] type The type to clone.
 	* @returns A deep clone of type. Caller is responsible for freeing.
@@ -103,21 +103,27 @@ typedef struct PRT_MACHINEID
 	PRT_UINT32 machineId;
 } PRT_MACHINEID;
 
-/** A set value is represented as a hash-table. */
+/** A set value is represented as an open-addressing hash index over insertion-ordered nodes. */
 typedef struct PRT_SETVALUE
 {
+	PRT_UINT32 refCount; /**< The number of boxes sharing this payload (copy-on-write). */
 	PRT_UINT32 size; /**< The number of elements in the set.      */
-	PRT_UINT32 capNum; /**< An opaque number related to the number of buckets */
+	PRT_UINT32 capNum; /**< An opaque number related to the number of slots */
+	PRT_UINT32 nDeleted; /**< The number of tombstone slots in the index. */
 	struct PRT_SETNODE* first; /**< First element inserted into the set. */
 	struct PRT_SETNODE* last; /**< Last element inserted into the set. */
-	struct PRT_SETNODE** buckets; /**< An array of pointers to chained nodes.  */
+	PRT_UINT32* slotHashes; /**< Cached hash per slot; 0 marks an empty slot, 1 a deleted one. */
+	struct PRT_SETNODE** slotNodes; /**< The node stored in each slot.  */
+	PRT_UINT32* oldSlotHashes; /**< The outgoing hash index while an incremental rehash runs, else NULL. */
+	struct PRT_SETNODE** oldSlotNodes; /**< The outgoing index's nodes while an incremental rehash runs. */
+	PRT_UINT32 oldCapNum; /**< The capacity number of the outgoing index. */
+	PRT_UINT32 rehashIndex; /**< The next slot of the outgoing index to migrate. */
 } PRT_SETVALUE;
 
 /** A key-value node of a map. */
 typedef struct PRT_SETNODE
 {
 	PRT_VALUE* item; /**< The key of this node. */
-	struct PRT_SETNODE* bucketNext; /**< The next node in this bucket.         */
 	struct PRT_SETNODE* insertNext; /**< The next node in insertion order.     */
 	struct PRT_SETNODE* insertPrev; /**< The previous node in insertion order. */
 } PRT_SETNODE;
@@ -177,29 +183,61 @@ PRT_API PRT_UINT32 PRT_CALL_CONV PrtSetSizeOf(_In_ PRT_VALUE* set);
 PRT_API PRT_UINT32 PRT_CALL_CONV PrtSetCapacity(_In_ PRT_VALUE* set);
 
 
+	/** Tuples with arity up to this and sequences with capacity up to this store
+	* their elements inline, in the same allocation as the payload header;
+	* `values` then points just past the header. Larger payloads keep a
+	* separately allocated element array.
+	*/
+#define PRT_VALUE_INLINE_SLOTS 4
+
 	/** A tuple value is a (named) tuple represented as an array. */
 	typedef struct PRT_TUPVALUE
 	{
+		PRT_UINT32 refCount; /**< The number of boxes sharing this payload (copy-on-write). */
 		PRT_UINT32 size;
-		PRT_VALUE** values; /**< Is an array of tuple args.    */
+		PRT_VALUE** values; /**< Is an array of tuple args; may point at inline storage after this struct. */
 	} PRT_TUPVALUE;
 
 	/** A sequence value is a sequence represented as a dynamic array. */
 	typedef struct PRT_SEQVALUE
 	{
+		PRT_UINT32 refCount; /**< The number of boxes sharing this payload (copy-on-write). */
 		PRT_UINT32 size; /**< The number of elements in the sequence. */
 		PRT_UINT32 capacity; /**< The number of elements before resizing  */
-		PRT_VALUE** values; /**< An array of values in the sequence.     */
+		PRT_VALUE** values; /**< An array of values in the sequence; may point at inline storage after this struct. */
 	} PRT_SEQVALUE;
 
-	/** A map value is represented as a hash-table. */
+	/** Allocates a tuple payload of the given arity with zeroed fields; the
+	* caller fills every field. Arities up to PRT_VALUE_INLINE_SLOTS use a
+	* single allocation with the elements stored inline.
+	* @param[in] arity The number of tuple fields.
+	* @returns The payload, with refCount 1 and size set to arity.
+	*/
+	PRT_API PRT_TUPVALUE* PRT_CALL_CONV PrtMkTuplePayload(_In_ PRT_UINT32 arity);
+
+	/** Allocates an empty sequence payload holding at least the given capacity.
+	* Capacities up to PRT_VALUE_INLINE_SLOTS use a single allocation with the
+	* elements stored inline.
+	* @param[in] capacity The number of elements to reserve.
+	* @returns The payload, with refCount 1 and size 0.
+	*/
+	PRT_API PRT_SEQVALUE* PRT_CALL_CONV PrtMkSeqPayload(_In_ PRT_UINT32 capacity);
+
+	/** A map value is represented as an open-addressing hash index over insertion-ordered nodes. */
 	typedef struct PRT_MAPVALUE
 	{
+		PRT_UINT32 refCount; /**< The number of boxes sharing this payload (copy-on-write). */
 		PRT_UINT32 size; /**< The number of elements in the map.      */
-		PRT_UINT32 capNum; /**< An opaque number related to the number of buckets */
+		PRT_UINT32 capNum; /**< An opaque number related to the number of slots */
+		PRT_UINT32 nDeleted; /**< The number of tombstone slots in the index. */
 		struct PRT_MAPNODE* first; /**< First element inserted into the map. */
 		struct PRT_MAPNODE* last; /**< Last element inserted into the map. */
-		struct PRT_MAPNODE** buckets; /**< An array of pointers to chained nodes.  */
+		PRT_UINT32* slotHashes; /**< Cached hash per slot; 0 marks an empty slot, 1 a deleted one. */
+		struct PRT_MAPNODE** slotNodes; /**< The node stored in each slot.  */
+		PRT_UINT32* oldSlotHashes; /**< The outgoing hash index while an incremental rehash runs, else NULL. */
+		struct PRT_MAPNODE** oldSlotNodes; /**< The outgoing index's nodes while an incremental rehash runs. */
+		PRT_UINT32 oldCapNum; /**< The capacity number of the outgoing index. */
+		PRT_UINT32 rehashIndex; /**< The next slot of the outgoing index to migrate. */
 	} PRT_MAPVALUE;
 
 	/** A key-value node of a map. */
@@ -207,7 +245,6 @@ PRT_API PRT_UINT32 PRT_CALL_CONV PrtSetCapacity(_In_ PRT_VALUE* set);
 	{
 		PRT_VALUE* key; /**< The key of this node. */
 		PRT_VALUE* value; /**< The value of this node. */
-		struct PRT_MAPNODE* bucketNext; /**< The next node in this bucket.         */
 		struct PRT_MAPNODE* insertNext; /**< The next node in insertion order.     */
 		struct PRT_MAPNODE* insertPrev; /**< The previous node in insertion order. */
 	} PRT_MAPNODE;
@@ -736,6 +773,32 @@ PRT_API PRT_UINT32 PRT_CALL_CONV PrtSetCapacity(_In_ PRT_VALUE* set);
 	*/
 	PRT_API PRT_BOOLEAN PRT_CALL_CONV PrtIsValidValue(_In_ PRT_VALUE* value);
 
+	/** Serializes a value into a compact self-delimiting binary encoding.
+	* Sequences whose elements all share one scalar kind are written as a raw
+	* array without per-element tags. Scalar widths follow the build, so the
+	* encoding is for exchange between identically built processes. Foreign
+	* values cannot be serialized. Pass a NULL buffer to measure the required size.
+	* @param[in] value The value to serialize.
+	* @param[out] buffer The destination buffer, or NULL to only measure.
+	* @param[in] bufferSize The usable bytes in buffer.
+	* @returns The number of bytes the encoding occupies.
+	*/
+	PRT_API PRT_UINT32 PRT_CALL_CONV PrtSerializeValue(
+		_In_	     PRT_VALUE* value,
+		_Out_	     PRT_UINT8* buffer,
+		_In_	     PRT_UINT32 bufferSize);
+
+	/** Builds a fresh value from a buffer written by PrtSerializeValue.
+	* The returned value owns all of its memory and is freed with PrtFreeValue.
+	* @param[in] buffer The buffer holding the serialized value.
+	* @param[in,out] nBytes In: the bytes available in buffer. Out: the bytes consumed.
+	* @returns The deserialized value.
+	* @see PrtFreeValue
+	*/
+	PRT_API PRT_VALUE* PRT_CALL_CONV PrtDeserializeValue(
+		_In_	     PRT_UINT8* buffer,
+		_Inout_	     PRT_UINT32* nBytes);
+
 	/** Nondeterministic Boolean choice
 	* @returns A nondeterministic Boolean value.  Caller is responsible for freeing.
 	*/
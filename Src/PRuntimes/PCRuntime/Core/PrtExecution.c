@@ -1,4 +1,6 @@
 #include "PrtExecution.h"
+#include "PrtTrace.h"
+#include "PrtTransport.h"
 #include "libhandler.h"
 
 // Can only run one P program at a time
@@ -56,11 +58,51 @@ PRT_ASSERT_FUN _PrtAssert = &PrtAssertDefaultFn;
 /* Initialize the function to default print fucntion*/
 PRT_PRINT_FUN PrtPrintf = &PrtPrintfDefaultFn;
 
+//// A queue's steady-state traffic cycles a handful of scalar event and
+//// payload shapes through it millions of times. Instead of returning every
+//// dequeued box to the allocator, a small per-queue stack keeps scalar boxes
+//// for the next PrtSendPrivate, which re-boxes incoming scalars into the
+//// recycled storage and frees the sender's box on the sender's own thread.
+static PRT_BOOLEAN PrtIsRecyclableBox(_In_ PRT_VALUE* value)
+{
+	switch (value->discriminator)
+	{
+	case PRT_VALUE_KIND_NULL:
+	case PRT_VALUE_KIND_BOOL:
+	case PRT_VALUE_KIND_INT:
+	case PRT_VALUE_KIND_FLOAT:
+	case PRT_VALUE_KIND_EVENT:
+		return PRT_TRUE;
+	default:
+		return PRT_FALSE;
+	}
+}
+
+static void PrtRecycleQueueValue(_Inout_ PRT_MACHINEINST_PRIV* context, _In_ PRT_VALUE* value)
+{
+	if (value == NULL)
+	{
+		return;
+	}
+	if (PrtIsRecyclableBox(value))
+	{
+		PrtLockMutex(context->stateMachineLock);
+		if (!context->isHalted && context->eventQueue.nRecycled < PRT_QUEUE_RECYCLE_MAX)
+		{
+			context->eventQueue.recycled[context->eventQueue.nRecycled++] = value;
+			PrtUnlockMutex(context->stateMachineLock);
+			return;
+		}
+		PrtUnlockMutex(context->stateMachineLock);
+	}
+	PrtFreeValue(value);
+}
+
 void PrtFreeTriggerPayload(_In_ PRT_MACHINEINST_PRIV* context)
 {
-	PrtFreeValue(context->currentTrigger);
+	PrtRecycleQueueValue(context, context->currentTrigger);
 	context->currentTrigger = NULL;
-	PrtFreeValue(context->currentPayload);
+	PrtRecycleQueueValue(context, context->currentPayload);
 	context->currentPayload = NULL;
 }
 
@@ -104,6 +146,94 @@ void PRT_CALL_CONV PrtSetLocalVarEx(_Inout_ PRT_VALUE** locals, _In_ PRT_UINT32
 	}
 }
 
+// Worker slot owned by the current PrtRunProcess/PrtStepProcess thread under the
+// work-stealing policy. Like the global `program`, this assumes one process per
+// address space.
+static PRT_THREAD_LOCAL PRT_INT32 prtWorkerIndex = -1;
+
+// Picks the queue a newly ready machine should be pushed onto. Worker threads
+// push onto their own queue; other threads spread machines by machine id so the
+// same machine keeps landing on the same worker.
+static PRT_WORKERQUEUE* PrtGetVictimQueue(PRT_COOPERATIVE_SCHEDULER* info, PRT_MACHINEINST_PRIV* context)
+{
+	if (prtWorkerIndex >= 0)
+	{
+		return &info->workerQueues[prtWorkerIndex];
+	}
+	PRT_UINT32 machineId = context->id->valueUnion.mid->machineId;
+	return &info->workerQueues[machineId % PRT_MAX_WORKSTEALING_WORKERS];
+}
+
+// Appends the machine to a per-worker ready queue. The isInReadyQueue flag is
+// guarded by the machine's own lock so senders on different threads do not
+// double-enqueue. Returns PRT_TRUE if the machine was enqueued.
+static PRT_BOOLEAN PrtWorkStealingPush(PRT_COOPERATIVE_SCHEDULER* info, PRT_MACHINEINST_PRIV* context)
+{
+	PrtLockMutex(context->stateMachineLock);
+	if (context->isInReadyQueue || context->isHalted)
+	{
+		PrtUnlockMutex(context->stateMachineLock);
+		return PRT_FALSE;
+	}
+	context->isInReadyQueue = PRT_TRUE;
+	context->readyNext = NULL;
+	PrtUnlockMutex(context->stateMachineLock);
+
+	PRT_WORKERQUEUE* queue = PrtGetVictimQueue(info, context);
+	PrtLockMutex(queue->lock);
+	if (queue->tail == NULL)
+	{
+		queue->head = context;
+	}
+	else
+	{
+		queue->tail->readyNext = context;
+	}
+	queue->tail = context;
+	PrtUnlockMutex(queue->lock);
+	return PRT_TRUE;
+}
+
+// Pops the next ready machine, trying this worker's own queue first and
+// stealing from the other workers only when it is empty.
+static PRT_MACHINEINST_PRIV* PrtWorkStealingPop(PRT_COOPERATIVE_SCHEDULER* info)
+{
+	for (PRT_UINT32 attempt = 0; attempt < PRT_MAX_WORKSTEALING_WORKERS; attempt++)
+	{
+		PRT_WORKERQUEUE* queue = &info->workerQueues[(prtWorkerIndex + attempt) % PRT_MAX_WORKSTEALING_WORKERS];
+		PrtLockMutex(queue->lock);
+		PRT_MACHINEINST_PRIV* context = queue->head;
+		if (context == NULL)
+		{
+			PrtUnlockMutex(queue->lock);
+			continue;
+		}
+		queue->head = context->readyNext;
+		if (queue->head == NULL)
+		{
+			queue->tail = NULL;
+		}
+		PrtUnlockMutex(queue->lock);
+
+		PrtLockMutex(context->stateMachineLock);
+		context->readyNext = NULL;
+		context->isInReadyQueue = PRT_FALSE;
+		if (context->isRunning && !context->isHalted)
+		{
+			PrtUnlockMutex(context->stateMachineLock);
+			// Stolen while mid-step on another worker. Hand the scheduling
+			// token straight back rather than dropping it, and keep looking
+			// for other work instead of spinning on a machine this worker
+			// cannot step yet.
+			PrtWorkStealingPush(info, context);
+			continue;
+		}
+		PrtUnlockMutex(context->stateMachineLock);
+		return context;
+	}
+	return NULL;
+}
+
 // This internal function is how we implement two different scheduling policies.
 // The original version is called PRT_SCHEDULINGPOLICY_TASKNEUTRAL which means the advancement of the state
 // machine is done on the callers thread (whichever thread), and it is done during PrtMkMachinePrivate
@@ -124,19 +254,70 @@ static void PrtScheduleWork(PRT_MACHINEINST_PRIV* context)
 	case PRT_SCHEDULINGPOLICY_COOPERATIVE:
 	{
 		PRT_COOPERATIVE_SCHEDULER* info = (PRT_COOPERATIVE_SCHEDULER*)privateProcess->schedulerInfo;
-		if (info->threadsWaiting > 0)
+		PrtLockMutex(privateProcess->processLock);
+		PRT_BOOLEAN enqueued = PRT_FALSE;
+		if (!context->isInReadyQueue && !context->isHalted)
+		{
+			// append the machine to the ready queue so PrtStepProcess can find it in O(1).
+			context->isInReadyQueue = PRT_TRUE;
+			context->readyNext = NULL;
+			if (info->readyQueueTail == NULL)
+			{
+				info->readyQueueHead = context;
+			}
+			else
+			{
+				info->readyQueueTail->readyNext = context;
+			}
+			info->readyQueueTail = context;
+			enqueued = PRT_TRUE;
+		}
+		PRT_UINT32 threadsWaiting = info->threadsWaiting;
+		PrtUnlockMutex(privateProcess->processLock);
+		if (enqueued && threadsWaiting > 0)
 		{
 			// signal the PrtRunProcess method that there is work to do.
 			PrtReleaseSemaphore(info->workAvailable);
 		}
 	}
 	break;
+	case PRT_SCHEDULINGPOLICY_WORKSTEALING:
+	{
+		PRT_COOPERATIVE_SCHEDULER* info = (PRT_COOPERATIVE_SCHEDULER*)privateProcess->schedulerInfo;
+		if (PrtWorkStealingPush(info, context))
+		{
+			PrtLockMutex(privateProcess->processLock);
+			PRT_UINT32 threadsWaiting = info->threadsWaiting;
+			PrtUnlockMutex(privateProcess->processLock);
+			if (threadsWaiting > 0)
+			{
+				PrtReleaseSemaphore(info->workAvailable);
+			}
+		}
+	}
+	break;
 	default:
 		PrtAssert(PRT_FALSE, "Invalid schedulingPolicy");
 		break;
 	}
 }
 
+//// Wait-free two-level lookup into the chunked machine table.
+static PRT_MACHINEINST* PrtMachineAt(_In_ PRT_PROCESS_PRIV* process, _In_ PRT_UINT32 index)
+{
+	return process->machineChunks[index / PRT_MACHINE_CHUNK_SIZE][index % PRT_MACHINE_CHUNK_SIZE];
+}
+
+//// TRUE if ptr lies inside the machine's creation arena and must not be freed individually.
+static PRT_BOOLEAN PrtIsArenaPtr(_In_ PRT_MACHINEINST_PRIV* context, _In_ const void* ptr)
+{
+	return context->arena != NULL
+		&& (const PRT_UINT8*)ptr >= context->arena
+		&& (const PRT_UINT8*)ptr < context->arena + context->arenaSize
+		? PRT_TRUE
+		: PRT_FALSE;
+}
+
 PRT_MACHINEINST_PRIV*
 PrtMkMachinePrivate(
 	_Inout_	         PRT_PROCESS_PRIV* process,
@@ -151,27 +332,38 @@ PrtMkMachinePrivate(
 
 	PRT_UINT8 eQSize = PRT_QUEUE_LEN_DEFAULT;
 
-	// Make space in process list for new machine
+	// Make space in the machine table for the new machine. Machines live in
+	// fixed-size chunks behind a chunk directory, so existing entries never
+	// move and concurrent PrtGetMachine callers need no lock.
 	PRT_UINT32 numMachines = process->numMachines;
-	PRT_UINT32 machineCount = process->machineCount;
-	PRT_MACHINEINST** machines = process->machines;
-	if (machineCount == 0)
-	{
-		machines = (PRT_MACHINEINST **)PrtCalloc(1, sizeof(PRT_MACHINEINST *));
-		process->machines = machines;
-		process->machineCount = 1;
-	}
-	else if (machineCount == numMachines)
+	PRT_UINT32 chunkIndex = numMachines / PRT_MACHINE_CHUNK_SIZE;
+	if (chunkIndex == process->machineChunkCount)
 	{
-		PRT_MACHINEINST** newMachines = (PRT_MACHINEINST **)PrtCalloc(2 * machineCount, sizeof(PRT_MACHINEINST *));
-		for (i = 0; i < machineCount; i++)
+		if (chunkIndex == process->machineChunkCapacity)
 		{
-			newMachines[i] = machines[i];
+			PRT_UINT32 newCapacity = process->machineChunkCapacity == 0
+				? PRT_MACHINE_DIR_INIT_CAPACITY
+				: 2 * process->machineChunkCapacity;
+			PRT_MACHINEINST*** newDir = (PRT_MACHINEINST ***)PrtCalloc(newCapacity, sizeof(PRT_MACHINEINST **));
+			for (i = 0; i < process->machineChunkCount; i++)
+			{
+				newDir[i] = process->machineChunks[i];
+			}
+			//// Retire the old directory instead of freeing it; a lock-free
+			//// reader may still be indexing through it. The new directory is
+			//// fully populated before it is published.
+			if (process->machineChunks != NULL)
+			{
+				PrtAssert(process->numRetiredMachineDirs < PRT_MACHINE_MAX_RETIRED_DIRS,
+					"Too many retired machine chunk directories");
+				process->retiredMachineDirs[process->numRetiredMachineDirs++] = process->machineChunks;
+			}
+			process->machineChunks = newDir;
+			process->machineChunkCapacity = newCapacity;
 		}
-		PrtFree(machines);
-		machines = newMachines;
-		process->machines = newMachines;
-		process->machineCount = 2 * machineCount;
+		process->machineChunks[chunkIndex] = (PRT_MACHINEINST **)PrtCalloc(
+			PRT_MACHINE_CHUNK_SIZE, sizeof(PRT_MACHINEINST *));
+		process->machineChunkCount++;
 	}
 
 	// Allocate memory for state machine context
@@ -180,8 +372,12 @@ PrtMkMachinePrivate(
 	// Assign the interface name
 	context->interfaceBound = interfaceName;
 
-	// Add it to the process list
-	machines[numMachines] = (PRT_MACHINEINST *)context;
+	// Add it to the process machine table
+	process->machineChunks[chunkIndex][numMachines % PRT_MACHINE_CHUNK_SIZE] = (PRT_MACHINEINST *)context;
+	//// Publish with release semantics: the directory swap, the new chunk and
+	//// the slot store must be visible before the count that makes the index
+	//// reachable to lock-free PrtGetMachine readers on weakly ordered targets.
+	__sync_synchronize();
 	process->numMachines++;
 
 	//
@@ -195,15 +391,12 @@ PrtMkMachinePrivate(
 	context->id = PrtMkMachineValue(id);
 
 	//
-	// Initialize the map used in PrtDist, map from sender to the last seqnumber received
+	// The ordered-delivery table used in PrtDist (sender to last sequence
+	// number received) is allocated lazily on the first in-order enqueue.
 	//
-	PRT_TYPE* domType = PrtMkPrimitiveType(PRT_KIND_MACHINE);
-	PRT_TYPE* codType = PrtMkPrimitiveType(PRT_KIND_INT);
-	PRT_TYPE* recvMapType = PrtMkMapType(domType, codType);
-	context->recvMap = PrtMkDefaultValue(recvMapType);
-	PrtFreeType(domType);
-	PrtFreeType(codType);
-	PrtFreeType(recvMapType);
+	context->recvTable = NULL;
+	context->recvTableCapacity = 0;
+	context->recvTableCount = 0;
 
 	// Initialize Machine Internal Variables
 	//
@@ -222,47 +415,72 @@ PrtMkMachinePrivate(
 	PRT_UINT32 nVars = curMachineDecl->nVars;
 
 	context->currentState = curMachineDecl->initStateIndex;
+
+	//
+	// Initialize various stacks
+	//
+	context->callStack.length = 0;
+
+	//
+	// Carve the machine's fixed-size buffers out of one arena, so creation is a
+	// single allocation and cleanup releases them all in one free. Values held
+	// in the buffers still own heap memory and are freed individually.
+	//
+	PRT_UINT32 packSize = PrtGetPackSize(context);
+	PRT_UINT32 arenaSize = nVars * (PRT_UINT32)sizeof(PRT_VALUE*)
+		+ eQSize * (PRT_UINT32)sizeof(PRT_EVENT)
+		+ (program->nEvents + (4 + 2 * PRT_MAX_STATESTACK_DEPTH) * packSize) * (PRT_UINT32)sizeof(PRT_UINT32);
+	PRT_UINT8* arena = (PRT_UINT8*)PrtCalloc(arenaSize, sizeof(PRT_UINT8));
+	context->arena = arena;
+	context->arenaSize = arenaSize;
+
 	context->varValues = NULL;
 	if (nVars > 0)
 	{
-		context->varValues = PrtCalloc(nVars, sizeof(PRT_VALUE*));
+		context->varValues = (PRT_VALUE**)arena;
+		arena += nVars * sizeof(PRT_VALUE*);
 		for (i = 0; i < nVars; i++)
 		{
 			context->varValues[i] = PrtMkDefaultValue(curMachineDecl->vars[i].type);
 		}
 	}
 
-	//
-	// Initialize various stacks
-	//
-	context->callStack.length = 0;
-
 	//
 	// Initialize event queue
 	//
 	context->eventQueue.eventsSize = eQSize;
-	context->eventQueue.events = (PRT_EVENT*)PrtCalloc(eQSize, sizeof(PRT_EVENT));
+	context->eventQueue.events = (PRT_EVENT*)arena;
+	arena += eQSize * sizeof(PRT_EVENT);
 	context->eventQueue.headIndex = 0;
 	context->eventQueue.tailIndex = 0;
 	context->eventQueue.size = 0;
+	context->eventQueue.nRecycled = 0;
+	context->inboxHead = NULL;
+	context->eventQueue.eventCounts = (PRT_UINT32*)arena;
+	arena += program->nEvents * sizeof(PRT_UINT32);
 
-	PRT_UINT32 packSize = PrtGetPackSize(context);
+	context->stats.numEnqueues = 0;
+	context->stats.numDequeues = 0;
+	context->stats.numHandlerInvocations = 0;
+	context->stats.maxQueueDepth = 0;
+	context->stats.queueDepth = 0;
 
 	//
-	// Initialize Inherited Deferred Set
+	// Initialize the inherited and current deferred sets and action sets
 	//
-	context->inheritedDeferredSetCompact = (PRT_UINT32*)PrtCalloc(packSize, sizeof(PRT_UINT32));
+	context->inheritedDeferredSetCompact = (PRT_UINT32*)arena;
+	arena += packSize * sizeof(PRT_UINT32);
+	context->currentDeferredSetCompact = (PRT_UINT32*)arena;
+	arena += packSize * sizeof(PRT_UINT32);
+	context->inheritedActionSetCompact = (PRT_UINT32*)arena;
+	arena += packSize * sizeof(PRT_UINT32);
+	context->currentActionSetCompact = (PRT_UINT32*)arena;
+	arena += packSize * sizeof(PRT_UINT32);
 
 	//
-	// Initialize the current deferred set
+	// Preallocate the per-frame inherited-set buffers so push/pop never allocate
 	//
-	context->currentDeferredSetCompact = (PRT_UINT32*)PrtCalloc(packSize, sizeof(PRT_UINT32));
-
-	//
-	// Initialize actions
-	//
-	context->inheritedActionSetCompact = (PRT_UINT32*)PrtCalloc(packSize, sizeof(PRT_UINT32));
-	context->currentActionSetCompact = (PRT_UINT32*)PrtCalloc(packSize, sizeof(PRT_UINT32));
+	context->stateStackSetSlab = (PRT_UINT32*)arena;
 
 	//
 	//Initialize state machine lock
@@ -300,30 +518,78 @@ PrtGetCurrentPayload(
 	return context->currentPayload;
 }
 
-void
-PrtSendPrivate(
+// Per-event payload check classification, built at install time. The payload
+// of every send is validated against the event's payload type; for `any` and
+// primitive payload types the deep PrtInhabitsType walk reduces to a table
+// lookup and at most one discriminator compare.
+#define PRT_PAYLOAD_CHECK_DEEP 0xff
+#define PRT_PAYLOAD_CHECK_ANY 0xfe
+static PRT_UINT8* payloadCheckKinds = NULL;
+
+//// Canonical (interned) payload type per event, kept beside the decl rather
+//// than written into it so a read-only program declaration stays read-only.
+static PRT_TYPE** eventPayloadTypes = NULL;
+
+//// Per-machine-type hibernation exemptions (program->nMachines entries);
+//// machine types are hibernation-eligible by default.
+static PRT_UINT8* machineHibernationExempt = NULL;
+
+//// Number of derived-metadata tables (packed event sets, transition and do
+//// lookups) the runtime itself allocated during PrtInstallProgram. When the
+//// code generator emits every table precomputed, this stays zero, the decls
+//// are never written to, and PrtUninstallProgram must not free or zero them:
+//// the program declaration may then live entirely in .rodata.
+static PRT_UINT32 programDerivedAllocs = 0;
+static PRT_BOOLEAN programMetadataStatic = PRT_FALSE;
+
+static void PrtHibernateMachine(_Inout_ PRT_MACHINEINST_PRIV* context);
+
+static PRT_UINT8 PrtPayloadCheckKind(_In_ PRT_TYPE* type)
+{
+	switch (type->typeKind)
+	{
+	case PRT_KIND_ANY:
+		return PRT_PAYLOAD_CHECK_ANY;
+	case PRT_KIND_BOOL:
+		return (PRT_UINT8)PRT_VALUE_KIND_BOOL;
+	case PRT_KIND_INT:
+		return (PRT_UINT8)PRT_VALUE_KIND_INT;
+	case PRT_KIND_FLOAT:
+		return (PRT_UINT8)PRT_VALUE_KIND_FLOAT;
+	case PRT_KIND_STRING:
+		return (PRT_UINT8)PRT_VALUE_KIND_STRING;
+	default:
+		return PRT_PAYLOAD_CHECK_DEEP;
+	}
+}
+
+// Checks that payload inhabits the payload type of event, consulting the
+// per-event classification before falling back to the recursive walk.
+static PRT_BOOLEAN PrtPayloadInhabitsEventType(_In_ PRT_VALUE* event, _In_ PRT_VALUE* payload)
+{
+	const PRT_UINT32 eventIndex = PrtPrimGetEvent(event);
+	const PRT_UINT8 check = payloadCheckKinds[eventIndex];
+	if (check == PRT_PAYLOAD_CHECK_ANY)
+	{
+		return PRT_TRUE;
+	}
+	if (check != PRT_PAYLOAD_CHECK_DEEP)
+	{
+		return payload->discriminator == (PRT_VALUE_KIND)check ? PRT_TRUE : PRT_FALSE;
+	}
+	return PrtInhabitsType(payload, eventPayloadTypes[eventIndex]);
+}
+
+//// Enqueues one event into the machine's queue. The caller holds
+//// stateMachineLock and the machine is not halted. Returns the overflow
+//// status the caller must raise after releasing the lock, if any.
+static PRT_STATUS PrtEnqueueLocked(
 	_In_	     PRT_MACHINESTATE* state,
 	_Inout_	     PRT_MACHINEINST_PRIV* context,
 	_In_	     PRT_VALUE* event,
 	_In_	     PRT_VALUE* payload
 )
 {
-	PrtAssert(!PrtIsSpecialEvent(event), "Enqueued event must not be null");
-	PrtAssert(PrtInhabitsType(payload, PrtGetPayloadType(context, event)),
-		"Payload must be member of event payload type");
-
-	PrtLockMutex(context->stateMachineLock);
-
-	if (context->isHalted)
-	{
-		// drop the event silently
-		PrtUnlockMutex(context->stateMachineLock);
-		// which means we must free the payload and event now, since we are not storing them in the queue.
-		PrtFreeValue(event);
-		PrtFreeValue(payload);
-		return;
-	}
-
 	const PRT_UINT32 eventIndex = PrtPrimGetEvent(event);
 	const PRT_UINT32 eventMaxInstances = program->events[eventIndex]->eventMaxInstances;
 	const PRT_UINT32 maxQueueSize = program->machines[context->instanceOf]->maxQueueSize;
@@ -333,9 +599,7 @@ PrtSendPrivate(
 	// check if maximum allowed instances of event are already present in queue
 	if (eventMaxInstances != 0xffffffff && PrtIsEventMaxInstanceExceeded(queue, eventIndex, eventMaxInstances))
 	{
-		PrtUnlockMutex(context->stateMachineLock);
-		PrtHandleError(PRT_STATUS_EVENT_OVERFLOW, context);
-		return;
+		return PRT_STATUS_EVENT_OVERFLOW;
 	}
 
 	// if queue is full, resize the queue if possible
@@ -343,15 +607,32 @@ PrtSendPrivate(
 	{
 		if (maxQueueSize != 0xffffffff && queue->size == maxQueueSize)
 		{
-			PrtUnlockMutex(context->stateMachineLock);
-			PrtHandleError(PRT_STATUS_QUEUE_OVERFLOW, context);
-			return;
+			return PRT_STATUS_QUEUE_OVERFLOW;
 		}
 		PrtResizeEventQueue(context);
 	}
 
 	const PRT_UINT32 tail = queue->tailIndex;
 
+	//// Re-box scalar trigger/payload values into boxes recycled from this
+	//// queue's earlier dequeues, freeing the sender's freshly made box on
+	//// the sender's own thread. The queue then circulates a small pool of
+	//// boxes instead of migrating them between threads.
+	if (queue->nRecycled > 0 && PrtIsRecyclableBox(event))
+	{
+		PRT_VALUE* box = queue->recycled[--queue->nRecycled];
+		*box = *event;
+		PrtFreeValue(event);
+		event = box;
+	}
+	if (queue->nRecycled > 0 && PrtIsRecyclableBox(payload))
+	{
+		PRT_VALUE* box = queue->recycled[--queue->nRecycled];
+		*box = *payload;
+		PrtFreeValue(payload);
+		payload = box;
+	}
+
 	//
 	// Add event to the queue
 	//
@@ -370,15 +651,337 @@ PrtSendPrivate(
 	}
 	queue->size++;
 	queue->tailIndex = (tail + 1) % queue->eventsSize;
+	queue->eventCounts[eventIndex]++;
+
+	context->stats.numEnqueues++;
+	if (queue->size > context->stats.maxQueueDepth)
+	{
+		context->stats.maxQueueDepth = queue->size;
+	}
 
 	//
 	//Log
 	//
 	PrtLog(PRT_STEP_ENQUEUE, state, context, event, payload);
+	return PRT_STATUS_SUCCESS;
+}
+
+void
+PrtSendPrivate(
+	_In_	     PRT_MACHINESTATE* state,
+	_Inout_	     PRT_MACHINEINST_PRIV* context,
+	_In_	     PRT_VALUE* event,
+	_In_	     PRT_VALUE* payload
+)
+{
+	PrtAssert(!PrtIsSpecialEvent(event), "Enqueued event must not be null");
+	PrtAssert(PrtPayloadInhabitsEventType(event, payload),
+		"Payload must be member of event payload type");
+
+#if defined(PRT_USE_LOCKFREE_INBOX) && (defined(PRT_USE_GCC) || defined(PRT_USE_CLANG))
+	//// Fan-in machines receive from hundreds of senders, and the producer
+	//// side of stateMachineLock convoys on them. Senders push onto the
+	//// machine's lock-free inbox stack instead; the machine drains it into
+	//// the ordinary queue under its own lock before each dequeue, so the
+	//// mutex remains only on the consumer, resize and halt paths.
+	if (context->isHalted)
+	{
+		// drop the event silently
+		PrtFreeValue(event);
+		PrtFreeValue(payload);
+		return;
+	}
+
+	PRT_INBOXNODE* node = (PRT_INBOXNODE *)PrtMalloc(sizeof(PRT_INBOXNODE));
+	node->trigger = event;
+	node->payload = payload;
+	if (state != NULL)
+	{
+		node->state = *state;
+		node->hasState = PRT_TRUE;
+	}
+	else
+	{
+		node->hasState = PRT_FALSE;
+	}
+
+	PRT_INBOXNODE* head;
+	do
+	{
+		head = context->inboxHead;
+		node->next = head;
+	}
+	while (!__sync_bool_compare_and_swap(&context->inboxHead, head, node));
+
+	//// The unlocked halted check above races with PrtCleanupMachine: the
+	//// machine may halt and run its final drain between the check and the
+	//// push, and would then never see this node. The CAS is a full barrier,
+	//// so re-checking after the push closes the window; on a late push the
+	//// sender sweeps the inbox itself under the lock and drops the events,
+	//// matching what the locked path does for a halted machine.
+	if (context->isHalted)
+	{
+		PrtLockMutex(context->stateMachineLock);
+		PRT_INBOXNODE* late = __sync_lock_test_and_set(&context->inboxHead, NULL);
+		PrtUnlockMutex(context->stateMachineLock);
+		while (late != NULL)
+		{
+			PRT_INBOXNODE* next = late->next;
+			PrtFreeValue(late->trigger);
+			PrtFreeValue(late->payload);
+			PrtFree(late);
+			late = next;
+		}
+		return;
+	}
+#else
+	PrtLockMutex(context->stateMachineLock);
+
+	if (context->isHalted)
+	{
+		// drop the event silently
+		PrtUnlockMutex(context->stateMachineLock);
+		// which means we must free the payload and event now, since we are not storing them in the queue.
+		PrtFreeValue(event);
+		PrtFreeValue(payload);
+		return;
+	}
+
+	const PRT_STATUS status = PrtEnqueueLocked(state, context, event, payload);
+	PrtUnlockMutex(context->stateMachineLock);
+	if (status != PRT_STATUS_SUCCESS)
+	{
+		PrtHandleError(status, context);
+		return;
+	}
+#endif
+	PrtScheduleWork(context);
+}
+
+#if defined(PRT_USE_LOCKFREE_INBOX) && (defined(PRT_USE_GCC) || defined(PRT_USE_CLANG))
+//// Moves every pending inbox node into the event queue in send order. The
+//// caller holds stateMachineLock.
+static void PrtInboxDrainLocked(_Inout_ PRT_MACHINEINST_PRIV* context)
+{
+	PRT_INBOXNODE* node = __sync_lock_test_and_set(&context->inboxHead, NULL);
+	PRT_INBOXNODE* fifo = NULL;
+	while (node != NULL)
+	{
+		PRT_INBOXNODE* next = node->next;
+		node->next = fifo;
+		fifo = node;
+		node = next;
+	}
+	while (fifo != NULL)
+	{
+		PRT_INBOXNODE* next = fifo->next;
+		const PRT_STATUS status = PrtEnqueueLocked(fifo->hasState ? &fifo->state : NULL, context,
+			fifo->trigger, fifo->payload);
+		PrtFree(fifo);
+		if (status != PRT_STATUS_SUCCESS)
+		{
+			PrtUnlockMutex(context->stateMachineLock);
+			PrtHandleError(status, context);
+			PrtLockMutex(context->stateMachineLock);
+		}
+		fifo = next;
+	}
+}
+#endif
+
+void
+PRT_CALL_CONV PrtSendBatch(
+	_In_	     PRT_MACHINESTATE* senderState,
+	_Inout_	     PRT_MACHINEINST* receiver,
+	_In_	     PRT_UINT32 numItems,
+	_Inout_	     PRT_SENDITEM* items
+)
+{
+	PRT_MACHINEINST_PRIV* context = (PRT_MACHINEINST_PRIV *)receiver;
+
+	for (PRT_UINT32 i = 0; i < numItems; i++)
+	{
+		PrtAssert(!PrtIsSpecialEvent(items[i].event), "Enqueued event must not be null");
+		PrtAssert(PrtPayloadInhabitsEventType(items[i].event, items[i].payload),
+			"Payload must be member of event payload type");
+	}
+
+	if (numItems == 0)
+	{
+		return;
+	}
+
+	PrtLockMutex(context->stateMachineLock);
+
+	if (context->isHalted)
+	{
+		// drop the events silently
+		PrtUnlockMutex(context->stateMachineLock);
+		// which means we must free the payloads and events now, since we are not storing them in the queue.
+		for (PRT_UINT32 i = 0; i < numItems; i++)
+		{
+			PrtFreeValue(items[i].event);
+			PrtFreeValue(items[i].payload);
+		}
+		return;
+	}
+
+	const PRT_UINT32 maxQueueSize = program->machines[context->instanceOf]->maxQueueSize;
+	PRT_EVENTQUEUE* queue = &context->eventQueue;
+
+	// the whole batch must fit; reserve the queue space in one shot
+	if (maxQueueSize != 0xffffffff && queue->size + numItems > maxQueueSize)
+	{
+		PrtUnlockMutex(context->stateMachineLock);
+		//// Ownership of the items passed to this call; nothing was enqueued,
+		//// so free them before reporting the rejection.
+		for (PRT_UINT32 i = 0; i < numItems; i++)
+		{
+			PrtFreeValue(items[i].event);
+			PrtFreeValue(items[i].payload);
+		}
+		PrtHandleError(PRT_STATUS_QUEUE_OVERFLOW, context);
+		return;
+	}
+
+	//// The per-event max-instance limits must also hold for the whole batch,
+	//// counting duplicates inside the batch itself, and must be known before
+	//// the first item is enqueued so a rejected batch is all-or-nothing. Walk
+	//// the items against eventCounts, provisionally counting each accepted
+	//// item so later duplicates see it, then roll the provisional counts back.
+	PRT_BOOLEAN batchFits = PRT_TRUE;
+	PRT_UINT32 numValidated = 0;
+	for (PRT_UINT32 i = 0; i < numItems; i++)
+	{
+		const PRT_UINT32 eventIndex = PrtPrimGetEvent(items[i].event);
+		const PRT_UINT32 eventMaxInstances = program->events[eventIndex]->eventMaxInstances;
+		if (eventMaxInstances != 0xffffffff && PrtIsEventMaxInstanceExceeded(queue, eventIndex, eventMaxInstances))
+		{
+			batchFits = PRT_FALSE;
+			break;
+		}
+		queue->eventCounts[eventIndex]++;
+		numValidated++;
+	}
+	for (PRT_UINT32 i = 0; i < numValidated; i++)
+	{
+		queue->eventCounts[PrtPrimGetEvent(items[i].event)]--;
+	}
+	if (!batchFits)
+	{
+		PrtUnlockMutex(context->stateMachineLock);
+		for (PRT_UINT32 i = 0; i < numItems; i++)
+		{
+			PrtFreeValue(items[i].event);
+			PrtFreeValue(items[i].payload);
+		}
+		PrtHandleError(PRT_STATUS_EVENT_OVERFLOW, context);
+		return;
+	}
+
+	while (queue->eventsSize - queue->size < numItems)
+	{
+		PrtResizeEventQueue(context);
+	}
+
+	for (PRT_UINT32 i = 0; i < numItems; i++)
+	{
+		PRT_VALUE* event = items[i].event;
+		PRT_VALUE* payload = items[i].payload;
+		const PRT_UINT32 eventIndex = PrtPrimGetEvent(event);
+
+		const PRT_UINT32 tail = queue->tailIndex;
+		queue->events[tail].trigger = event;
+		queue->events[tail].payload = payload;
+		if (senderState != NULL)
+		{
+			queue->events[tail].state = *senderState;
+		}
+		else
+		{
+			queue->events[tail].state.machineId = 0;
+			queue->events[tail].state.machineName = NULL;
+			queue->events[tail].state.stateId = 0;
+			queue->events[tail].state.stateName = NULL;
+		}
+		queue->size++;
+		queue->tailIndex = (tail + 1) % queue->eventsSize;
+		queue->eventCounts[eventIndex]++;
+
+		PrtLog(PRT_STEP_ENQUEUE, senderState, context, event, payload);
+	}
+
+	context->stats.numEnqueues += numItems;
+	if (queue->size > context->stats.maxQueueDepth)
+	{
+		context->stats.maxQueueDepth = queue->size;
+	}
+
 	PrtUnlockMutex(context->stateMachineLock);
+
+	// One wakeup for the whole batch; PrtScheduleWork coalesces further
+	// requests while the machine is already on a ready queue.
 	PrtScheduleWork(context);
 }
 
+//// The ordered-delivery table used to be a generic value map, which cost
+//// three hashtable traversals and a boxed integer per message while holding
+//// stateMachineLock. The specialized table below keys on the raw machine id
+//// and resolves a sender's slot with a single linear probe.
+
+#define PRT_RECVTABLE_INIT_CAPACITY 8
+
+static PRT_BOOLEAN PrtRecvSlotMatches(_In_ const PRT_RECVSLOT* slot, _In_ const PRT_MACHINEID* source)
+{
+	return slot->source.machineId == source->machineId &&
+		slot->source.processId.data1 == source->processId.data1 &&
+		slot->source.processId.data2 == source->processId.data2 &&
+		slot->source.processId.data3 == source->processId.data3 &&
+		slot->source.processId.data4 == source->processId.data4
+		? PRT_TRUE
+		: PRT_FALSE;
+}
+
+//// Returns the slot holding source, or the empty slot where it belongs.
+//// The capacity is a power of two and the table is kept under 3/4 full, so
+//// the probe sequence always terminates.
+static PRT_RECVSLOT* PrtRecvTableFind(_In_ PRT_RECVSLOT* table, _In_ PRT_UINT32 capacity, _In_ const PRT_MACHINEID* source)
+{
+	PRT_UINT32 slot = (source->machineId * 2654435761U ^ source->processId.data1) & (capacity - 1);
+	while (table[slot].source.machineId != 0 && !PrtRecvSlotMatches(&table[slot], source))
+	{
+		slot = (slot + 1) & (capacity - 1);
+	}
+	return &table[slot];
+}
+
+//// Finds the sender's slot, lazily creating or growing the table. The caller
+//// must hold stateMachineLock.
+static PRT_RECVSLOT* PrtRecvTableLookup(_Inout_ PRT_MACHINEINST_PRIV* context, _In_ const PRT_MACHINEID* source)
+{
+	if (context->recvTable == NULL)
+	{
+		context->recvTable = (PRT_RECVSLOT *)PrtCalloc(PRT_RECVTABLE_INIT_CAPACITY, sizeof(PRT_RECVSLOT));
+		context->recvTableCapacity = PRT_RECVTABLE_INIT_CAPACITY;
+	}
+	else if (4 * (context->recvTableCount + 1) > 3 * context->recvTableCapacity)
+	{
+		const PRT_UINT32 newCapacity = context->recvTableCapacity * 2;
+		PRT_RECVSLOT* newTable = (PRT_RECVSLOT *)PrtCalloc(newCapacity, sizeof(PRT_RECVSLOT));
+		for (PRT_UINT32 i = 0; i < context->recvTableCapacity; i++)
+		{
+			if (context->recvTable[i].source.machineId != 0)
+			{
+				*PrtRecvTableFind(newTable, newCapacity, &context->recvTable[i].source) = context->recvTable[i];
+			}
+		}
+		PrtFree(context->recvTable);
+		context->recvTable = newTable;
+		context->recvTableCapacity = newCapacity;
+	}
+	return PrtRecvTableFind(context->recvTable, context->recvTableCapacity, source);
+}
+
 void
 PrtEnqueueInOrder(
 	_In_	     PRT_VALUE* source,
@@ -397,13 +1000,22 @@ PrtEnqueueInOrder(
 		return;
 	}
 
-	if (PrtMapExists(context->recvMap, source) && PrtMapGet(context->recvMap, source)->valueUnion.nt >= seqNum)
+	PRT_RECVSLOT* slot = PrtRecvTableLookup(context, source->valueUnion.mid);
+	if (slot->source.machineId != 0)
 	{
-		PrtUnlockMutex(context->stateMachineLock);
-		// Drop the event
-		return;
+		if (slot->lastSeqNum >= seqNum)
+		{
+			PrtUnlockMutex(context->stateMachineLock);
+			// Drop the event
+			return;
+		}
 	}
-	PrtMapUpdate(context->recvMap, source, PrtMkIntValue((PRT_INT32)seqNum));
+	else
+	{
+		slot->source = *source->valueUnion.mid;
+		context->recvTableCount++;
+	}
+	slot->lastSeqNum = seqNum;
 	PrtUnlockMutex(context->stateMachineLock);
 
 	// get the name of the sender machine.
@@ -413,13 +1025,40 @@ PrtEnqueueInOrder(
 	PrtSendPrivate(&state, context, event, payload);
 }
 
+//// The number of payload arguments marshalled on the stack before falling back to the heap.
+//// Matches the argument array the code generator emits into every function body.
+#define PRT_MAX_INLINE_ARGS 32
+
+//// Allocates a tuple of the given arity with unset fields; the caller fills every field.
+static PRT_VALUE* PrtMkTupleShell(_In_ PRT_UINT32 arity)
+{
+	PRT_VALUE* retVal = (PRT_VALUE*)PrtMalloc(sizeof(PRT_VALUE));
+	retVal->discriminator = PRT_VALUE_KIND_TUPLE;
+	retVal->valueUnion.tuple = PrtMkTuplePayload(arity);
+	return retVal;
+}
+
 PRT_VALUE* MakeTupleFromArray(_In_ PRT_TYPE* tupleType, _In_ PRT_VALUE** elems)
 {
 	PRT_UINT32 arity = tupleType->typeUnion.tuple->arity;
-	PRT_VALUE* payload = PrtMkDefaultValue(tupleType);
+	//// Build the tuple in place instead of overwriting a freshly made default value.
+	PRT_VALUE* payload = PrtMkTupleShell(arity);
+	for (PRT_UINT32 i = 0; i < arity; i++)
+	{
+		payload->valueUnion.tuple->values[i] = elems[i];
+	}
+	return payload;
+}
+
+//// Like MakeTupleFromArray, but consumes caller-provided argument references.
+static PRT_VALUE* MakeTupleFromRefs(_In_ PRT_TYPE* tupleType, _Inout_ PRT_VALUE*** argRefs)
+{
+	PRT_UINT32 arity = tupleType->typeUnion.tuple->arity;
+	PRT_VALUE* payload = PrtMkTupleShell(arity);
 	for (PRT_UINT32 i = 0; i < arity; i++)
 	{
-		PrtTupleSetEx(payload, i, elems[i], PRT_FALSE);
+		payload->valueUnion.tuple->values[i] = *argRefs[i];
+		*argRefs[i] = NULL;
 	}
 	return payload;
 }
@@ -459,7 +1098,8 @@ PrtGoto(
 	}
 	else
 	{
-		PRT_VALUE** args = PrtCalloc(numArgs, sizeof(PRT_VALUE*));
+		PRT_VALUE* inlineArgs[PRT_MAX_INLINE_ARGS];
+		PRT_VALUE** args = numArgs <= PRT_MAX_INLINE_ARGS ? inlineArgs : PrtCalloc(numArgs, sizeof(PRT_VALUE*));
 		va_list argp;
 		va_start(argp, numArgs);
 		for (PRT_UINT32 i = 0; i < numArgs; i++)
@@ -476,7 +1116,10 @@ PrtGoto(
 			PRT_TYPE* payloadType = entryFun->payloadType;
 			payload = MakeTupleFromArray(payloadType, args);
 		}
-		PrtFree(args);
+		if (args != inlineArgs)
+		{
+			PrtFree(args);
+		}
 	}
 
 	PrtSetTriggerPayload(context, PrtMkEventValue(PRT_SPECIAL_EVENT_NULL), payload);
@@ -505,7 +1148,8 @@ PrtRaise(
 	}
 	else
 	{
-		PRT_VALUE** args = PrtCalloc(numArgs, sizeof(PRT_VALUE*));
+		PRT_VALUE* inlineArgs[PRT_MAX_INLINE_ARGS];
+		PRT_VALUE** args = numArgs <= PRT_MAX_INLINE_ARGS ? inlineArgs : PrtCalloc(numArgs, sizeof(PRT_VALUE*));
 		va_list argp;
 		va_start(argp, numArgs);
 		for (PRT_UINT32 i = 0; i < numArgs; i++)
@@ -521,9 +1165,12 @@ PrtRaise(
 			PRT_TYPE* payloadType = PrtGetPayloadType(context, event);
 			payload = MakeTupleFromArray(payloadType, args);
 		}
-		PrtFree(args);
+		if (args != inlineArgs)
+		{
+			PrtFree(args);
+		}
 	}
-	PrtAssert(PrtInhabitsType(payload, PrtGetPayloadType(context, event)),
+	PrtAssert(PrtPayloadInhabitsEventType(event, payload),
 		"Payload must be member of event payload type");
 
 	PrtSetTriggerPayload(context, event, payload);
@@ -611,6 +1258,32 @@ void* prt_receive_handler(PRT_MACHINEINST_PRIV* context, PRT_SM_FUN action, PRT_
 		rargs)));
 }
 
+void PRT_CALL_CONV PrtReceiveCases(
+	_Inout_	        PRT_MACHINEINST* receiver,
+	_In_	        PRT_RECEIVEDECL* receiveDecl
+)
+{
+	PRT_MACHINEINST_PRIV* context = (PRT_MACHINEINST_PRIV*)receiver;
+	PrtAssert(context->receiveResumption == NULL && context->pendingReceive == NULL,
+		"Machine is already blocked on a receive");
+	PrtAssert(receiveDecl->nCases > 0, "A receive must have at least one case");
+	context->pendingReceive = receiveDecl;
+	context->returnKind = ReceiveStatement;
+}
+
+//// Finds the case of a pending stackless receive that handles eventId, or NULL.
+static PRT_CASEDECL* PrtFindReceiveCase(_In_ PRT_RECEIVEDECL* receiveDecl, _In_ PRT_UINT32 eventId)
+{
+	for (PRT_UINT32 i = 0; i < receiveDecl->nCases; i++)
+	{
+		if (PrtPrimGetEvent(&receiveDecl->cases[i].triggerEvent->value) == eventId)
+		{
+			return &receiveDecl->cases[i];
+		}
+	}
+	return NULL;
+}
+
 #pragma endregion
 
 void
@@ -630,11 +1303,21 @@ PrtPushState(
 	{
 		const PRT_UINT16 length = context->callStack.length;
 		PrtAssert(length < PRT_MAX_STATESTACK_DEPTH, "State stack overflow");
+		//
+		// Each frame snapshots the inherited sets into its preallocated
+		// slab buffers, so pushing never allocates.
+		//
+		PRT_UINT32* frameDeferred = context->stateStackSetSlab + (2 * length) * packSize;
+		PRT_UINT32* frameActions = context->stateStackSetSlab + (2 * length + 1) * packSize;
+		for (PRT_UINT16 i = 0; i < packSize; ++i)
+		{
+			frameDeferred[i] = context->inheritedDeferredSetCompact[i];
+			frameActions[i] = context->inheritedActionSetCompact[i];
+		}
+
 		context->callStack.stateStack[length].stateIndex = context->currentState;
-		context->callStack.stateStack[length].inheritedDeferredSetCompact = PrtClonePackedSet(
-			context->inheritedDeferredSetCompact, packSize);
-		context->callStack.stateStack[length].inheritedActionSetCompact = PrtClonePackedSet(
-			context->inheritedActionSetCompact, packSize);
+		context->callStack.stateStack[length].inheritedDeferredSetCompact = frameDeferred;
+		context->callStack.stateStack[length].inheritedActionSetCompact = frameActions;
 		context->callStack.length = length + 1;
 	}
 
@@ -709,8 +1392,6 @@ PrtPopState(
 		context->inheritedDeferredSetCompact[i] = popped_state.inheritedDeferredSetCompact[i];
 		context->inheritedActionSetCompact[i] = popped_state.inheritedActionSetCompact[i];
 	}
-	PrtFree(popped_state.inheritedDeferredSetCompact);
-	PrtFree(popped_state.inheritedActionSetCompact);
 
 	PrtUpdateCurrentActionsSet(context);
 	PrtUpdateCurrentDeferredSet(context);
@@ -747,6 +1428,11 @@ PRT_RETURN_KIND PrtResume(PRT_MACHINEINST_PRIV* context, PRT_UINT32 eventId, PRT
 
 bool PrtReceiveWaitingOnEvent(PRT_MACHINEINST_PRIV* context, PRT_UINT32 event_value)
 {
+	if (context->pendingReceive != NULL)
+	{
+		return PrtFindReceiveCase(context->pendingReceive, event_value) != NULL;
+	}
+
 	if (context->receiveAllowedEvents == NULL)
 	{
 		return false;
@@ -802,6 +1488,7 @@ PRT_BOOLEAN PrtCallEventHandler(PRT_MACHINEINST_PRIV* context, PRT_SM_FUN functi
 	PrtAssert(context->receiveResumption == NULL && context->receiveAllowedEvents == NULL,
 		"When waiting on receive, must resume");
 	context->returnKind = ReturnStatement;
+	context->stats.numHandlerInvocations++;
 	prt_receive_handler(context, function, args);
 	return PrtHandleUserReturn(context);
 }
@@ -896,6 +1583,18 @@ PRT_BOOLEAN PrtHandleEvent(PRT_MACHINEINST_PRIV* context)
 static PRT_BOOLEAN
 PrtDequeueOrReceive(_Inout_ PRT_MACHINEINST_PRIV* context, PRT_VALUE* trigger, PRT_VALUE* payload)
 {
+	if (context->pendingReceive != NULL)
+	{
+		//// Stackless receive: run the matching case function as a fresh
+		//// handler instead of resuming a captured continuation.
+		PRT_RECEIVEDECL* receiveDecl = context->pendingReceive;
+		PRT_CASEDECL* recvCase = PrtFindReceiveCase(receiveDecl, PrtPrimGetEvent(trigger));
+		PrtAssert(recvCase != NULL, "Dequeued an event with no matching receive case");
+		context->pendingReceive = NULL;
+		PrtSetTriggerPayload(context, trigger, payload);
+		return PrtCallEventHandler(context, recvCase->fun->implementation, &context->handlerArguments);
+	}
+
 	if (context->receiveResumption == NULL)
 	{
 		PrtSetTriggerPayload(context, trigger, payload);
@@ -922,6 +1621,9 @@ PrtStepStateMachine(
 		return PrtCallEntryHandler(context);
 	case DequeueOrReceive:
 		PrtLockMutex(context->stateMachineLock);
+#if defined(PRT_USE_LOCKFREE_INBOX) && (defined(PRT_USE_GCC) || defined(PRT_USE_CLANG))
+		PrtInboxDrainLocked(context);
+#endif
 		// If the machine is blocked on a receive statement, then
 		// PrtDequeueEvent is guaranteed to return an event meant
 		// for that receive statement.
@@ -995,6 +1697,46 @@ PrtRunStateMachine(
 	PrtLockMutex(context->stateMachineLock);
 	context->isRunning = PRT_FALSE;
 	PrtUnlockMutex(context->stateMachineLock);
+
+	PrtHibernateMachine(context);
+}
+
+//// A mostly-idle machine permanently holds whatever queue storage its
+//// busiest burst ever needed. When a machine drains its queue and leaves the
+//// scheduler, shrink a heap-grown events array back to a minimal size (and
+//// drop the recycled box cache); the next PrtSendPrivate regrows it lazily.
+//// The initial arena-backed array is left alone since freeing it would
+//// reclaim nothing. PrtSetMachineHibernation exempts hot machine types.
+static void PrtHibernateMachine(_Inout_ PRT_MACHINEINST_PRIV* context)
+{
+	PrtLockMutex(context->stateMachineLock);
+	PRT_EVENTQUEUE* queue = &context->eventQueue;
+	if (!context->isHalted && machineHibernationExempt[context->instanceOf] == 0)
+	{
+		if (queue->size == 0 &&
+			queue->eventsSize > PRT_QUEUE_LEN_HIBERNATED &&
+			!PrtIsArenaPtr(context, queue->events))
+		{
+			PrtFree(queue->events);
+			queue->events = (PRT_EVENT *)PrtCalloc(PRT_QUEUE_LEN_HIBERNATED, sizeof(PRT_EVENT));
+			queue->eventsSize = PRT_QUEUE_LEN_HIBERNATED;
+			queue->headIndex = 0;
+			queue->tailIndex = 0;
+		}
+		for (PRT_UINT32 i = 0; i < queue->nRecycled; i++)
+		{
+			PrtFreeValue(queue->recycled[i]);
+		}
+		queue->nRecycled = 0;
+	}
+	PrtUnlockMutex(context->stateMachineLock);
+}
+
+void PRT_CALL_CONV PrtSetMachineHibernation(_In_ PRT_UINT32 machineIndex, _In_ PRT_BOOLEAN enable)
+{
+	PrtAssert(program != NULL, "program must be installed");
+	PrtAssert(machineIndex < program->nMachines, "machineIndex out of bounds");
+	machineHibernationExempt[machineIndex] = enable == PRT_FALSE ? 1 : 0;
 }
 
 PRT_API PRT_STEP_RESULT
@@ -1005,51 +1747,94 @@ PrtStepProcess(PRT_PROCESS* process)
 	PrtLockMutex(privateProcess->processLock);
 	PRT_COOPERATIVE_SCHEDULER* info = (PRT_COOPERATIVE_SCHEDULER*)privateProcess->schedulerInfo;
 	info->threadsWaiting++;
-	PRT_UINT32 machineCount = privateProcess->machineCount;
-	PrtUnlockMutex(privateProcess->processLock);
 
-	PRT_BOOLEAN terminating = PRT_FALSE;
+	PRT_BOOLEAN terminating = privateProcess->terminating;
+	PRT_BOOLEAN workStealing = privateProcess->schedulingPolicy == PRT_SCHEDULINGPOLICY_WORKSTEALING;
 	PRT_BOOLEAN hasMoreWork = PRT_FALSE;
-	// Run all state machines belonging to this process.
-	for (int i = machineCount - 1; i >= 0; i--)
+	PRT_MACHINEINST_PRIV* context = NULL;
+	if (workStealing && prtWorkerIndex < 0)
 	{
-		PrtLockMutex(privateProcess->processLock);
-		terminating = privateProcess->terminating;
-		if (terminating)
+		// first call on this thread: claim a worker slot (and its ready queue).
+		prtWorkerIndex = (PRT_INT32)(info->nextWorker % PRT_MAX_WORKSTEALING_WORKERS);
+		info->nextWorker++;
+	}
+	if (!terminating && !workStealing)
+	{
+		// Pop the next ready machine in O(1); the machines array is kept only for PrtGetMachine lookups.
+		context = info->readyQueueHead;
+		if (context != NULL)
 		{
-			break;
+			info->readyQueueHead = context->readyNext;
+			if (info->readyQueueHead == NULL)
+			{
+				info->readyQueueTail = NULL;
+			}
+			context->readyNext = NULL;
+			context->isInReadyQueue = PRT_FALSE;
 		}
-		PRT_MACHINEINST_PRIV* context = (PRT_MACHINEINST_PRIV*)privateProcess->machines[i];
-		PrtUnlockMutex(privateProcess->processLock);
+	}
+	PrtUnlockMutex(privateProcess->processLock);
 
-		// todo: assign each context a persistent thread id. only allow wake-ups on the same thread.
-		if (context != NULL)
+	if (!terminating && workStealing)
+	{
+		context = PrtWorkStealingPop(info);
+	}
+
+	if (context != NULL)
+	{
+		// protecting against re-entry using isRunning boolean.
+		PrtLockMutex(context->stateMachineLock);
+		if (context->isHalted)
+		{
+			PrtUnlockMutex(context->stateMachineLock);
+		}
+		else if (context->isRunning)
 		{
-			// protecting against re-entry using isRunning boolean.
+			PrtUnlockMutex(context->stateMachineLock);
+			//// The pop consumed the machine's only scheduling token. The
+			//// running thread decides whether it has more work before it
+			//// clears isRunning, so an event enqueued in that window would
+			//// strand the machine if the token were dropped here; hand the
+			//// token back instead of discarding it.
+			PrtScheduleWork(context);
+		}
+		else
+		{
+			context->isRunning = PRT_TRUE;
+			PrtUnlockMutex(context->stateMachineLock);
+			hasMoreWork = PrtStepStateMachine(context);
+
 			PrtLockMutex(context->stateMachineLock);
-			if (context->isHalted || context->isRunning)
+			context->isRunning = PRT_FALSE;
+			PrtUnlockMutex(context->stateMachineLock);
+
+			if (hasMoreWork)
 			{
-				PrtUnlockMutex(context->stateMachineLock);
+				// The machine still has pending events; put it back on the ready queue.
+				PrtScheduleWork(context);
 			}
 			else
 			{
-				context->isRunning = PRT_TRUE;
-				PrtUnlockMutex(context->stateMachineLock);
-				hasMoreWork |= PrtStepStateMachine(context);
-
-				PrtLockMutex(context->stateMachineLock);
-				context->isRunning = PRT_FALSE;
-				PrtUnlockMutex(context->stateMachineLock);
+				PrtHibernateMachine(context);
 			}
 		}
 	}
 
-	if (!terminating)
+	if (workStealing)
 	{
-		PrtLockMutex(privateProcess->processLock);
+		// the caller should keep stepping while this worker's own queue is non-empty.
+		PRT_WORKERQUEUE* ownQueue = &info->workerQueues[prtWorkerIndex];
+		PrtLockMutex(ownQueue->lock);
+		hasMoreWork = ownQueue->head != NULL ? PRT_TRUE : hasMoreWork;
+		PrtUnlockMutex(ownQueue->lock);
 	}
 
-	hasMoreWork |= machineCount < privateProcess->machineCount;
+	PrtLockMutex(privateProcess->processLock);
+	terminating = privateProcess->terminating;
+	if (!workStealing)
+	{
+		hasMoreWork = info->readyQueueHead != NULL ? PRT_TRUE : hasMoreWork;
+	}
 	info->threadsWaiting--;
 	PRT_UINT32 threadsWaiting = info->threadsWaiting;
 	PrtUnlockMutex(privateProcess->processLock);
@@ -1068,19 +1853,12 @@ PrtFindTransition(
 	_In_	     PRT_UINT32 eventIndex
 )
 {
-	PRT_UINT32 i;
-	PRT_UINT32 nTransitions;
-
-	PRT_TRANSDECL* transTable = PrtGetTransitionTable(context, context->currentState, &nTransitions);
-
-	for (i = 0; i < nTransitions; ++i)
-	{
-		if (transTable[i].triggerEvent->value.valueUnion.ev == eventIndex)
-		{
-			break;
-		}
-	}
-	return i;
+	//
+	// The per-state lookup table is built at program-install time, so
+	// dispatch is a single indexed load instead of a scan of the
+	// transition array.
+	//
+	return program->machines[context->instanceOf]->states[context->currentState].transLookup[eventIndex];
 }
 
 void
@@ -1108,6 +1886,8 @@ RemoveElementFromQueue(_Inout_ PRT_MACHINEINST_PRIV* context, _In_ PRT_UINT32 i)
 	PRT_UINT32 queueLength = queue->eventsSize;
 	PRT_UINT32 head = queue->headIndex;
 
+	queue->eventCounts[PrtPrimGetEvent(queue->events[(head + i) % queueLength].trigger)]--;
+
 	//
 	// Collapse the event queue on the removed event
 	// by moving the previous elements forward.
@@ -1140,7 +1920,7 @@ PrtDequeueEvent(_Inout_ PRT_MACHINEINST_PRIV* context, _Out_ PRT_VALUE** trigger
 
 	PRT_DBG_ASSERT(queue->size <= queue_length, "Check Failed");
 
-	const bool waiting_on_receive = context->receiveResumption != NULL;
+	const bool waiting_on_receive = context->receiveResumption != NULL || context->pendingReceive != NULL;
 
 	for (PRT_UINT32 i = 0; i < queue->size; i++)
 	{
@@ -1155,6 +1935,7 @@ PrtDequeueEvent(_Inout_ PRT_MACHINEINST_PRIV* context, _Out_ PRT_VALUE** trigger
 			*trigger = e.trigger;
 			*payload = e.payload;
 			RemoveElementFromQueue(context, i);
+			context->stats.numDequeues++;
 			PrtLog(PRT_STEP_DEQUEUE, &e.state, context, e.trigger, e.payload);
 			return PRT_TRUE;
 		}
@@ -1185,7 +1966,7 @@ PrtGetPayloadType(
 	_In_	     PRT_VALUE* event
 )
 {
-	return program->events[PrtPrimGetEvent(event)]->type;
+	return eventPayloadTypes[PrtPrimGetEvent(event)];
 }
 
 FORCEINLINE
@@ -1227,7 +2008,6 @@ PrtGetAction(
 	_In_	     PRT_UINT32 currEvent
 )
 {
-	PRT_UINT32 ui, nActions;
 	PRT_DODECL* actionDecl = NULL;
 	//check if action is defined for the current state
 	PRT_BOOLEAN isActionInstalled =
@@ -1235,18 +2015,10 @@ PrtGetAction(
 	if (isActionInstalled)
 	{
 		//
-		// get action function
+		// get action function via the install-time lookup table
 		//
 		PRT_STATEDECL* stateDecl = PrtGetCurrentStateDecl(context);
-		nActions = stateDecl->nDos;
-		for (ui = 0; ui < nActions; ui++)
-		{
-			if (stateDecl->dos[ui].triggerEvent->value.valueUnion.ev == currEvent)
-			{
-				actionDecl = &stateDecl->dos[ui];
-				return actionDecl;
-			}
-		}
+		return &stateDecl->dos[stateDecl->doLookup[currEvent]];
 	}
 
 	//
@@ -1261,17 +2033,9 @@ PrtGetAction(
 		if (isActionInstalled)
 		{
 			//
-			// get action function
+			// get action function via the install-time lookup table
 			//
-			nActions = stateTable[topOfStackState].nDos;
-			for (ui = 0; ui < nActions; ui++)
-			{
-				if (stateTable[topOfStackState].dos[ui].triggerEvent->value.valueUnion.ev == currEvent)
-				{
-					actionDecl = &stateTable[topOfStackState].dos[ui];
-					return actionDecl;
-				}
-			}
+			return &stateTable[topOfStackState].dos[stateTable[topOfStackState].doLookup[currEvent]];
 		}
 	}
 
@@ -1337,59 +2101,12 @@ PrtIsEventMaxInstanceExceeded(
 	_In_	     PRT_UINT32 eventIndex,
 	_In_	     PRT_UINT32 maxInstances
 )
-{
-	PRT_UINT32 queueSize = queue->eventsSize;
-	PRT_UINT32 head = queue->headIndex;
-	PRT_UINT32 tail = queue->tailIndex;
-	PRT_UINT16 currMaxInstance = 0;
-	PRT_BOOLEAN isMaxInstancesExceeded = PRT_FALSE;
-	//
-	// head is ahead of tail
-	//
-	if (head > tail)
-	{
-		//
-		// Check from head to end of Array
-		//
-		while (head < queueSize)
-		{
-			if (PrtPrimGetEvent(queue->events[head].trigger) == eventIndex)
-			{
-				currMaxInstance = currMaxInstance + 1;
-				head++;
-			}
-			else
-			{
-				head++;
-			}
-		}
-		//
-		// Reset Head to the start of Array
-		head = 0;
-	}
-
+{
 	//
-	// Check from start of Array till head
+	// The per-event occupancy counts are maintained on enqueue/dequeue,
+	// so there is no need to walk the queue.
 	//
-	while (head < tail)
-	{
-		if (PrtPrimGetEvent(queue->events[head].trigger) == eventIndex)
-		{
-			currMaxInstance = currMaxInstance + 1;
-			head++;
-		}
-		else
-		{
-			head++;
-		}
-	}
-
-	if (currMaxInstance >= maxInstances)
-	{
-		isMaxInstancesExceeded = PRT_TRUE;
-	}
-
-	return isMaxInstancesExceeded;
+	return queue->eventCounts[eventIndex] >= maxInstances ? PRT_TRUE : PRT_FALSE;
 }
 
 FORCEINLINE
@@ -1577,8 +2294,11 @@ PrtResizeEventQueue(
 	context->eventQueue.tailIndex = newTail;
 	context->eventQueue.eventsSize = newQueueSize;
 
-	//Release the older Queue
-	PrtFree(oldQueue);
+	//Release the older Queue (the initial, arena-backed storage is freed with the arena)
+	if (!PrtIsArenaPtr(context, oldQueue))
+	{
+		PrtFree(oldQueue);
+	}
 }
 
 void
@@ -1616,6 +2336,9 @@ PrtCleanupMachine(
 		PrtAssert(op == ReturnStatement, "cleanup of blocked machine failed.");
 	}
 
+	// A stackless receive holds no captured stack, so there is nothing to unwind.
+	context->pendingReceive = NULL;
+
 	// Free machine's state
 	PrtLockMutex(context->stateMachineLock);
 	if (context->eventQueue.events != NULL)
@@ -1642,20 +2365,13 @@ PrtCleanupMachine(
 		}
 	}
 
-	PrtFree(context->eventQueue.events);
-
-	for (PRT_INT32 i = 0; i < context->callStack.length; i++)
+	//// The queue storage is arena-backed unless the queue grew past its
+	//// initial size, in which case the grown array lives on the heap.
+	if (!PrtIsArenaPtr(context, context->eventQueue.events))
 	{
-		PRT_STATESTACK_INFO* info = &context->callStack.stateStack[i];
-		PrtFree(info->inheritedActionSetCompact);
-		PrtFree(info->inheritedDeferredSetCompact);
+		PrtFree(context->eventQueue.events);
 	}
 
-	PrtFree(context->currentActionSetCompact);
-	PrtFree(context->currentDeferredSetCompact);
-	PrtFree(context->inheritedActionSetCompact);
-	PrtFree(context->inheritedDeferredSetCompact);
-
 	if (context->varValues != NULL)
 	{
 		PRT_MACHINEDECL* mdecl = program->machines[context->instanceOf];
@@ -1666,11 +2382,33 @@ PrtCleanupMachine(
 		}
 	}
 
-	PrtFree(context->varValues);
+#if defined(PRT_USE_LOCKFREE_INBOX) && (defined(PRT_USE_GCC) || defined(PRT_USE_CLANG))
+	PRT_INBOXNODE* inboxNode = __sync_lock_test_and_set(&context->inboxHead, NULL);
+	while (inboxNode != NULL)
+	{
+		PRT_INBOXNODE* inboxNext = inboxNode->next;
+		PrtFreeValue(inboxNode->trigger);
+		PrtFreeValue(inboxNode->payload);
+		PrtFree(inboxNode);
+		inboxNode = inboxNext;
+	}
+#endif
 
 	PrtFreeTriggerPayload(context);
+
+	for (PRT_UINT32 i = 0; i < context->eventQueue.nRecycled; i++)
+	{
+		PrtFreeValue(context->eventQueue.recycled[i]);
+	}
+	context->eventQueue.nRecycled = 0;
+
 	PrtFreeValue(context->id);
-	PrtFreeValue(context->recvMap);
+	PrtFree(context->recvTable);
+	context->recvTable = NULL;
+
+	//// Every remaining fixed-size buffer was carved from the creation arena.
+	PrtFree(context->arena);
+	context->arena = NULL;
 
 	PrtUnlockMutex(context->stateMachineLock);
 }
@@ -1736,6 +2474,8 @@ PrtLog(
 	_In_	     PRT_VALUE* payload
 )
 {
+	PrtTraceStep(step, receiver->id->valueUnion.mid->machineId, receiver->currentState,
+		eventId == NULL ? PRT_TRACE_NO_EVENT : PrtPrimGetEvent(eventId));
 	((PRT_PROCESS_PRIV *)receiver->process)->logHandler(step, senderState, (PRT_MACHINEINST *)receiver, eventId,
 		payload);
 }
@@ -1767,6 +2507,7 @@ void PrtTraverseEventset(PRT_EVENTSETDECL* evset, PRT_BOOLEAN doInstall)
 			PRT_UINT32 unitSize = sizeof(PRT_UINT32) * 8;
 			PRT_UINT32 packedArraySize = program->nEvents / unitSize + 1;
 			evset->packedEvents = (PRT_UINT32 *)PrtCalloc(packedArraySize, sizeof(PRT_UINT32));
+			programDerivedAllocs++;
 			for (PRT_UINT32 i = 0; i < evset->nEvents; i++)
 			{
 				PRT_UINT32 eventIndex = evset->events[i]->value.valueUnion.ev;
@@ -1791,6 +2532,49 @@ void PrtTraverseState(PRT_STATEDECL* state, PRT_BOOLEAN doInstall)
 	PrtTraverseEventset(state->defersSet, doInstall);
 	PrtTraverseEventset(state->doSet, doInstall);
 	PrtTraverseEventset(state->transSet, doInstall);
+
+	if (doInstall)
+	{
+		if (state->transLookup == NULL)
+		{
+			state->transLookup = (PRT_UINT32 *)PrtCalloc(program->nEvents, sizeof(PRT_UINT32));
+			programDerivedAllocs++;
+			for (PRT_UINT32 i = 0; i < program->nEvents; i++)
+			{
+				state->transLookup[i] = state->nTransitions;
+			}
+			for (PRT_UINT32 i = 0; i < state->nTransitions; i++)
+			{
+				state->transLookup[state->transitions[i].triggerEvent->value.valueUnion.ev] = i;
+			}
+		}
+		if (state->doLookup == NULL)
+		{
+			state->doLookup = (PRT_UINT32 *)PrtCalloc(program->nEvents, sizeof(PRT_UINT32));
+			programDerivedAllocs++;
+			for (PRT_UINT32 i = 0; i < program->nEvents; i++)
+			{
+				state->doLookup[i] = state->nDos;
+			}
+			for (PRT_UINT32 i = 0; i < state->nDos; i++)
+			{
+				state->doLookup[state->dos[i].triggerEvent->value.valueUnion.ev] = i;
+			}
+		}
+	}
+	else
+	{
+		if (state->transLookup != NULL)
+		{
+			PrtFree(state->transLookup);
+			state->transLookup = NULL;
+		}
+		if (state->doLookup != NULL)
+		{
+			PrtFree(state->doLookup);
+			state->doLookup = NULL;
+		}
+	}
 }
 
 void PrtTraverseMachine(PRT_MACHINEDECL* machine, PRT_BOOLEAN doInstall)
@@ -1808,37 +2592,75 @@ void PrtInstallProgram(_In_ PRT_PROGRAMDECL* p)
 	lh_register_malloc((lh_mallocfun*)PrtMalloc, (lh_callocfun*)PrtCalloc, (lh_reallocfun*)PrtRealloc, (lh_freefun*)PrtFree);
 
 	program = p;
+	programDerivedAllocs = 0;
+	payloadCheckKinds = (PRT_UINT8 *)PrtCalloc(p->nEvents, sizeof(PRT_UINT8));
+	eventPayloadTypes = (PRT_TYPE **)PrtCalloc(p->nEvents, sizeof(PRT_TYPE *));
+	machineHibernationExempt = (PRT_UINT8 *)PrtCalloc(p->nMachines, sizeof(PRT_UINT8));
 	for (PRT_UINT32 i = 0; i < p->nEvents; i++)
 	{
-		p->events[i]->value.valueUnion.ev = i;
+		//// Every decl store below is skipped when the declaration already
+		//// carries the value, so a fully pre-initialized declaration is never
+		//// written to and may be placed in read-only memory by the generator.
+		if (p->events[i]->value.valueUnion.ev != i)
+		{
+			p->events[i]->value.valueUnion.ev = i;
+		}
+		//// Canonicalize the payload type so equality on it is a pointer
+		//// compare, and classify how its per-send inhabitation check can be
+		//// performed. The canonical pointer lives in a runtime side table,
+		//// not in the decl: generators need not dedupe structurally equal
+		//// type objects, and a read-only decl must never be written.
+		eventPayloadTypes[i] = PrtInternType(p->events[i]->type);
+		payloadCheckKinds[i] = PrtPayloadCheckKind(eventPayloadTypes[i]);
 	}
 	for (PRT_UINT32 i = 0; i < p->nMachines; i++)
 	{
-		p->machines[i]->declIndex = i;
+		if (p->machines[i]->declIndex != i)
+		{
+			p->machines[i]->declIndex = i;
+		}
 		PrtTraverseMachine(p->machines[i], PRT_TRUE);
 	}
 	for (PRT_UINT32 i = 0; i < p->nForeignTypes; i++)
 	{
-		p->foreignTypes[i]->declIndex = i;
+		if (p->foreignTypes[i]->declIndex != i)
+		{
+			p->foreignTypes[i]->declIndex = i;
+		}
 	}
+	programMetadataStatic = programDerivedAllocs == 0;
 }
 
 void PrtUninstallProgram()
 {
 	PrtAssert(program != NULL, "program must be non-NULL");
-	for (PRT_UINT32 i = 0; i < program->nEvents; i++)
+	//// A static program declaration (all derived tables emitted by the code
+	//// generator) was never written to during install and may be read-only;
+	//// leave it untouched so the same declaration can be installed again.
+	if (!programMetadataStatic)
 	{
-		program->events[i]->value.valueUnion.ev = 0;
-	}
-	for (PRT_UINT32 i = 0; i < program->nMachines; i++)
-	{
-		program->machines[i]->declIndex = 0;
-		PrtTraverseMachine(program->machines[i], PRT_FALSE);
-	}
-	for (PRT_UINT32 i = 0; i < program->nForeignTypes; i++)
-	{
-		program->foreignTypes[i]->declIndex = 0;
+		for (PRT_UINT32 i = 0; i < program->nEvents; i++)
+		{
+			program->events[i]->value.valueUnion.ev = 0;
+		}
+		for (PRT_UINT32 i = 0; i < program->nMachines; i++)
+		{
+			program->machines[i]->declIndex = 0;
+			PrtTraverseMachine(program->machines[i], PRT_FALSE);
+		}
+		for (PRT_UINT32 i = 0; i < program->nForeignTypes; i++)
+		{
+			program->foreignTypes[i]->declIndex = 0;
+		}
 	}
+	programMetadataStatic = PRT_FALSE;
+	PrtFree(payloadCheckKinds);
+	payloadCheckKinds = NULL;
+	PrtFree(eventPayloadTypes);
+	eventPayloadTypes = NULL;
+	PrtFree(machineHibernationExempt);
+	machineHibernationExempt = NULL;
+	PrtClearInternedTypes();
 	program = NULL;
 }
 
@@ -1857,8 +2679,10 @@ PrtStartProcess(
 	process->errorHandler = errorFun;
 	process->logHandler = logFun;
 	process->processLock = PrtCreateMutex();
-	process->machineCount = 0;
-	process->machines = NULL;
+	process->machineChunkCount = 0;
+	process->machineChunkCapacity = 0;
+	process->machineChunks = NULL;
+	process->numRetiredMachineDirs = 0;
 	process->numMachines = 0;
 	process->schedulingPolicy = PRT_SCHEDULINGPOLICY_TASKNEUTRAL;
 	process->schedulerInfo = NULL;
@@ -1886,8 +2710,9 @@ PrtWaitForWork(PRT_PROCESS* process)
 	PRT_PROCESS_PRIV* privateProcess = (PRT_PROCESS_PRIV*)process;
 	PrtLockMutex(privateProcess->processLock);
 
-	PrtAssert(privateProcess->schedulingPolicy == PRT_SCHEDULINGPOLICY_COOPERATIVE,
-		"PrtWaitForWork can only be called when PrtSetSchedulingPolicy has set PRT_SCHEDULINGPOLICY_COOPERATIVE mode");
+	PrtAssert(privateProcess->schedulingPolicy == PRT_SCHEDULINGPOLICY_COOPERATIVE ||
+		privateProcess->schedulingPolicy == PRT_SCHEDULINGPOLICY_WORKSTEALING,
+		"PrtWaitForWork can only be called when PrtSetSchedulingPolicy has set PRT_SCHEDULINGPOLICY_COOPERATIVE or PRT_SCHEDULINGPOLICY_WORKSTEALING mode");
 	PRT_COOPERATIVE_SCHEDULER* info = (PRT_COOPERATIVE_SCHEDULER*)privateProcess->schedulerInfo;
 
 	info->threadsWaiting++;
@@ -1915,6 +2740,14 @@ static void PrtDestroyCooperativeScheduler(PRT_COOPERATIVE_SCHEDULER* info)
 	{
 		PrtDestroySemaphore(info->workAvailable);
 		PrtDestroySemaphore(info->allThreadsStopped);
+		if (info->workerQueues != NULL)
+		{
+			for (PRT_UINT32 i = 0; i < PRT_MAX_WORKSTEALING_WORKERS; i++)
+			{
+				PrtDestroyMutex(info->workerQueues[i].lock);
+			}
+			PrtFree(info->workerQueues);
+		}
 		PrtFree(info);
 	}
 }
@@ -1926,20 +2759,81 @@ PrtSetSchedulingPolicy(PRT_PROCESS* process, PRT_SCHEDULINGPOLICY policy)
 	if (privateProcess->schedulingPolicy != policy)
 	{
 		privateProcess->schedulingPolicy = policy;
-		if (policy == PRT_SCHEDULINGPOLICY_COOPERATIVE)
+		if (policy == PRT_SCHEDULINGPOLICY_COOPERATIVE || policy == PRT_SCHEDULINGPOLICY_WORKSTEALING)
 		{
+			PrtDestroyCooperativeScheduler(privateProcess->schedulerInfo);
+
 			PRT_COOPERATIVE_SCHEDULER* info = (PRT_COOPERATIVE_SCHEDULER*)PrtMalloc(sizeof(PRT_COOPERATIVE_SCHEDULER));
 			PrtAssert(info != NULL, "Out of memory");
 
 			info->workAvailable = PrtCreateSemaphore(0, 32767);
 			info->threadsWaiting = 0;
 			info->allThreadsStopped = PrtCreateSemaphore(0, 32767);
+			info->readyQueueHead = NULL;
+			info->readyQueueTail = NULL;
+			info->nextWorker = 0;
+			info->workerQueues = NULL;
+			if (policy == PRT_SCHEDULINGPOLICY_WORKSTEALING)
+			{
+				info->workerQueues = (PRT_WORKERQUEUE*)PrtCalloc(PRT_MAX_WORKSTEALING_WORKERS, sizeof(PRT_WORKERQUEUE));
+				for (PRT_UINT32 i = 0; i < PRT_MAX_WORKSTEALING_WORKERS; i++)
+				{
+					info->workerQueues[i].lock = PrtCreateMutex();
+				}
+			}
 
 			privateProcess->schedulerInfo = info;
+
+			// Machines created before the policy switch may already have pending
+			// events, so seed the ready queues with all of them.
+			PrtLockMutex(privateProcess->processLock);
+			for (PRT_UINT32 i = 0; i < privateProcess->numMachines; i++)
+			{
+				PRT_MACHINEINST_PRIV* context = (PRT_MACHINEINST_PRIV*)PrtMachineAt(privateProcess, i);
+				if (context == NULL)
+				{
+					continue;
+				}
+				context->isInReadyQueue = PRT_FALSE;
+				context->readyNext = NULL;
+				if (context->isHalted)
+				{
+					continue;
+				}
+				if (policy == PRT_SCHEDULINGPOLICY_WORKSTEALING)
+				{
+					PrtWorkStealingPush(info, context);
+				}
+				else
+				{
+					context->isInReadyQueue = PRT_TRUE;
+					if (info->readyQueueTail == NULL)
+					{
+						info->readyQueueHead = context;
+					}
+					else
+					{
+						info->readyQueueTail->readyNext = context;
+					}
+					info->readyQueueTail = context;
+				}
+			}
+			PrtUnlockMutex(privateProcess->processLock);
 		}
 		else if (policy == PRT_SCHEDULINGPOLICY_TASKNEUTRAL)
 		{
 			// this is where we could implement other policies...
+			PrtLockMutex(privateProcess->processLock);
+			for (PRT_UINT32 i = 0; i < privateProcess->numMachines; i++)
+			{
+				PRT_MACHINEINST_PRIV* context = (PRT_MACHINEINST_PRIV*)PrtMachineAt(privateProcess, i);
+				if (context != NULL)
+				{
+					context->isInReadyQueue = PRT_FALSE;
+					context->readyNext = NULL;
+				}
+			}
+			PrtUnlockMutex(privateProcess->processLock);
 			PrtDestroyCooperativeScheduler(privateProcess->schedulerInfo);
 			privateProcess->schedulerInfo = NULL;
 		}
@@ -1963,6 +2857,18 @@ PrtRunProcess(PRT_PROCESS* process)
 		case PRT_STEP_TERMINATING:
 			return;
 		case PRT_STEP_IDLE:
+			if (PrtTransportDrain(process) > 0)
+			{
+				break;
+			}
+			if (PrtTransportIsListening() == PRT_TRUE)
+			{
+				//// A listening process has no doorbell for inbound shared-memory
+				//// sends; the work semaphore is only released by local sends. Poll
+				//// the ring instead of blocking on it.
+				PrtYieldThread();
+				break;
+			}
 			if (PrtWaitForWork(process) == PRT_TRUE)
 			{
 				return;
@@ -1975,6 +2881,55 @@ PrtRunProcess(PRT_PROCESS* process)
 	}
 }
 
+//
+// Threshold below which PrtStopProcess tears machines down on one thread,
+// and the number of shards (including the calling thread) above it.
+//
+#define PRT_TEARDOWN_MIN_MACHINES 4096
+#define PRT_TEARDOWN_WORKERS 4
+
+typedef struct PRT_TEARDOWNSHARD
+{
+	PRT_PROCESS_PRIV* process;
+	PRT_UINT32 begin;
+	PRT_UINT32 end;
+} PRT_TEARDOWNSHARD;
+
+static void PrtTeardownMachineRange(_Inout_ PRT_PROCESS_PRIV* process, _In_ PRT_UINT32 begin, _In_ PRT_UINT32 end)
+{
+	for (PRT_UINT32 i = begin; i < end; i++)
+	{
+		PRT_MACHINEINST* context = PrtMachineAt(process, i);
+		PRT_MACHINEINST_PRIV* privContext = (PRT_MACHINEINST_PRIV *)context;
+
+		PrtCleanupMachine(privContext);
+		if (privContext->stateMachineLock != NULL)
+		{
+			PrtDestroyMutex(privContext->stateMachineLock);
+		}
+		PrtFree(context);
+	}
+}
+
+static void PRT_CALL_CONV PrtTeardownWorker(_In_ void* arg)
+{
+	PRT_TEARDOWNSHARD* shard = (PRT_TEARDOWNSHARD *)arg;
+	PrtTeardownMachineRange(shard->process, shard->begin, shard->end);
+}
+
+#if !defined(PRT_PLAT_LINUXUSER)
+//// Platforms without a helper-thread implementation fall back to serial
+//// teardown via the NULL return.
+PRT_API void* PRT_CALL_CONV PrtCreateThread(_In_ void (PRT_CALL_CONV* fn)(void*), _In_ void* arg)
+{
+	return NULL;
+}
+
+PRT_API void PRT_CALL_CONV PrtJoinThread(_In_ void* thread)
+{
+}
+#endif
+
 void
 PrtStopProcess(
 	_Inout_	PRT_PROCESS* process
@@ -1987,7 +2942,8 @@ PrtStopProcess(
 	PRT_BOOLEAN waitForThreads = PRT_FALSE;
 	PRT_COOPERATIVE_SCHEDULER* info = NULL;
 
-	if (privateProcess->schedulingPolicy == PRT_SCHEDULINGPOLICY_COOPERATIVE)
+	if (privateProcess->schedulingPolicy == PRT_SCHEDULINGPOLICY_COOPERATIVE ||
+		privateProcess->schedulingPolicy == PRT_SCHEDULINGPOLICY_WORKSTEALING)
 	{
 		info = (PRT_COOPERATIVE_SCHEDULER*)privateProcess->schedulerInfo;
 		int count = info->threadsWaiting;
@@ -2009,20 +2965,52 @@ PrtStopProcess(
 	}
 
 	// ok, now we can safely start deleting things...
-	for (PRT_UINT32 i = 0; i < privateProcess->numMachines; i++)
-	{
-		PRT_MACHINEINST* context = privateProcess->machines[i];
-		PRT_MACHINEINST_PRIV* privContext = (PRT_MACHINEINST_PRIV *)context;
-
-		PrtCleanupMachine(privContext);
-		if (privContext->stateMachineLock != NULL)
+	const PRT_UINT32 numMachines = privateProcess->numMachines;
+	if (numMachines >= PRT_TEARDOWN_MIN_MACHINES)
+	{
+		//// Tearing down a large deployment single-threaded is dominated by
+		//// recursive value frees. The machines are independent by now (the
+		//// scheduler threads have exited), so partition the machine table
+		//// across helper threads; each shard only touches its own machines
+		//// and the allocator paths are thread-safe.
+		PRT_TEARDOWNSHARD shards[PRT_TEARDOWN_WORKERS];
+		void* threads[PRT_TEARDOWN_WORKERS];
+		const PRT_UINT32 step = numMachines / PRT_TEARDOWN_WORKERS;
+		for (PRT_UINT32 w = 1; w < PRT_TEARDOWN_WORKERS; w++)
 		{
-			PrtDestroyMutex(privContext->stateMachineLock);
+			shards[w].process = privateProcess;
+			shards[w].begin = w * step;
+			shards[w].end = w == PRT_TEARDOWN_WORKERS - 1 ? numMachines : (w + 1) * step;
+			threads[w] = PrtCreateThread(&PrtTeardownWorker, &shards[w]);
+			if (threads[w] == NULL)
+			{
+				// no helper threads on this platform; do the shard inline.
+				PrtTeardownMachineRange(privateProcess, shards[w].begin, shards[w].end);
+			}
+		}
+		PrtTeardownMachineRange(privateProcess, 0, step);
+		for (PRT_UINT32 w = 1; w < PRT_TEARDOWN_WORKERS; w++)
+		{
+			if (threads[w] != NULL)
+			{
+				PrtJoinThread(threads[w]);
+			}
 		}
-		PrtFree(context);
+	}
+	else
+	{
+		PrtTeardownMachineRange(privateProcess, 0, numMachines);
 	}
 
-	PrtFree(privateProcess->machines);
+	for (PRT_UINT32 i = 0; i < privateProcess->machineChunkCount; i++)
+	{
+		PrtFree(privateProcess->machineChunks[i]);
+	}
+	PrtFree(privateProcess->machineChunks);
+	for (PRT_UINT32 i = 0; i < privateProcess->numRetiredMachineDirs; i++)
+	{
+		PrtFree(privateProcess->retiredMachineDirs[i]);
+	}
 	PrtDestroyCooperativeScheduler(info);
 	PrtDestroyMutex(privateProcess->processLock);
 	PrtUninstallProgram();
@@ -2065,7 +3053,8 @@ PrtMkInterface(
 	}
 	else
 	{
-		PRT_VALUE** args = PrtCalloc(numArgs, sizeof(PRT_VALUE*));
+		PRT_VALUE* inlineArgs[PRT_MAX_INLINE_ARGS];
+		PRT_VALUE** args = numArgs <= PRT_MAX_INLINE_ARGS ? inlineArgs : PrtCalloc(numArgs, sizeof(PRT_VALUE*));
 		va_list argp;
 		va_start(argp, numArgs);
 		for (PRT_UINT32 i = 0; i < numArgs; i++)
@@ -2084,7 +3073,50 @@ PrtMkInterface(
 			PRT_TYPE* payloadType = entryFun->payloadType;
 			payload = MakeTupleFromArray(payloadType, args);
 		}
-		PrtFree(args);
+		if (args != inlineArgs)
+		{
+			PrtFree(args);
+		}
+	}
+	PRT_MACHINEINST* result = (PRT_MACHINEINST*)PrtMkMachinePrivate((PRT_PROCESS_PRIV *)context->process,
+		interfaceCreated, instance_of, payload);
+	// must now free this payload because PrtMkMachinePrivate clones it.
+	PrtFreeValue(payload);
+	return result;
+}
+
+PRT_MACHINEINST*
+PrtMkInterfaceEx(
+	_In_	     PRT_MACHINEINST* creator,
+	_In_	     PRT_UINT32 IName,
+	_In_	     PRT_UINT32 numArgs,
+	_Inout_	     PRT_VALUE*** argRefs
+)
+{
+	PRT_MACHINEINST_PRIV* context = (PRT_MACHINEINST_PRIV*)creator;
+	PRT_VALUE* payload;
+	const PRT_UINT32 interfaceCreated = program->linkMap[context->interfaceBound][IName];
+	const PRT_UINT32 instance_of = program->interfaceDefMap[interfaceCreated];
+
+	// Check the CreateOk condition
+	PrtAssert(PrtInterfaceInCreatesSet(interfaceCreated, program->machines[creator->instanceOf]->creates),
+		"Created interface is not in the creates set of the machine");
+
+	if (numArgs == 0)
+	{
+		payload = PrtMkNullValue();
+	}
+	else if (numArgs == 1)
+	{
+		payload = *argRefs[0];
+		*argRefs[0] = NULL;
+	}
+	else
+	{
+		PRT_MACHINEDECL* machineDecl = program->machines[instance_of];
+		PRT_FUNDECL* entryFun = machineDecl->states[machineDecl->initStateIndex].entryFun;
+		PRT_TYPE* payloadType = entryFun->payloadType;
+		payload = MakeTupleFromRefs(payloadType, argRefs);
 	}
 	PRT_MACHINEINST* result = (PRT_MACHINEINST*)PrtMkMachinePrivate((PRT_PROCESS_PRIV *)context->process,
 		interfaceCreated, instance_of, payload);
@@ -2110,7 +3142,8 @@ PrtMkMachine(
 	}
 	else
 	{
-		PRT_VALUE** args = PrtCalloc(numArgs, sizeof(PRT_VALUE*));
+		PRT_VALUE* inlineArgs[PRT_MAX_INLINE_ARGS];
+		PRT_VALUE** args = numArgs <= PRT_MAX_INLINE_ARGS ? inlineArgs : PrtCalloc(numArgs, sizeof(PRT_VALUE*));
 		va_list argp;
 		va_start(argp, numArgs);
 		for (PRT_UINT32 i = 0; i < numArgs; i++)
@@ -2129,7 +3162,44 @@ PrtMkMachine(
 			PRT_TYPE* payloadType = entryFun->payloadType;
 			payload = MakeTupleFromArray(payloadType, args);
 		}
-		PrtFree(args);
+		if (args != inlineArgs)
+		{
+			PrtFree(args);
+		}
+	}
+	PRT_MACHINEINST* result = (PRT_MACHINEINST*)PrtMkMachinePrivate((PRT_PROCESS_PRIV *)process, interfaceName,
+		instanceOf, payload);
+	// free the payload since we cloned it here, and PrtMkMachinePrivate also clones it.
+	PrtFreeValue(payload);
+	return result;
+}
+
+PRT_MACHINEINST*
+PrtMkMachineEx(
+	_Inout_	         PRT_PROCESS* process,
+	_In_	         PRT_UINT32 interfaceName,
+	_In_	         PRT_UINT32 numArgs,
+	_Inout_	         PRT_VALUE*** argRefs
+)
+{
+	PRT_VALUE* payload;
+	PRT_UINT32 instanceOf = program->interfaceDefMap[interfaceName];
+
+	if (numArgs == 0)
+	{
+		payload = PrtMkNullValue();
+	}
+	else if (numArgs == 1)
+	{
+		payload = *argRefs[0];
+		*argRefs[0] = NULL;
+	}
+	else
+	{
+		PRT_MACHINEDECL* machineDecl = program->machines[instanceOf];
+		PRT_FUNDECL* entryFun = machineDecl->states[machineDecl->initStateIndex].entryFun;
+		PRT_TYPE* payloadType = entryFun->payloadType;
+		payload = MakeTupleFromRefs(payloadType, argRefs);
 	}
 	PRT_MACHINEINST* result = (PRT_MACHINEINST*)PrtMkMachinePrivate((PRT_PROCESS_PRIV *)process, interfaceName,
 		instanceOf, payload);
@@ -2150,7 +3220,11 @@ PrtGetMachine(
 	//PrtAssert(PrtAreGuidsEqual(process->guid, machineId->processId), "id does not belong to process");
 	PRT_PROCESS_PRIV* privateProcess = (PRT_PROCESS_PRIV *)process;
 	PrtAssert((0 < machineId->machineId) && (machineId->machineId <= privateProcess->numMachines), "id out of bounds");
-	return privateProcess->machines[machineId->machineId - 1];
+	//// Acquire side of the release barrier in PrtMkMachinePrivate: having
+	//// observed the count cover this index, the directory and slot stores
+	//// behind it must be visible before we index through them.
+	__sync_synchronize();
+	return PrtMachineAt(privateProcess, machineId->machineId - 1);
 }
 
 void PRT_CALL_CONV PrtGetMachineState(_In_ PRT_MACHINEINST* context, _Inout_ PRT_MACHINESTATE* state)
@@ -2162,6 +3236,46 @@ void PRT_CALL_CONV PrtGetMachineState(_In_ PRT_MACHINEINST* context, _Inout_ PRT
 	state->stateName = PrtGetCurrentStateDecl(priv)->name;
 }
 
+void PRT_CALL_CONV PrtGetMachineStats(_In_ PRT_MACHINEINST* context, _Out_ PRT_MACHINESTATS* stats)
+{
+	PRT_MACHINEINST_PRIV* priv = (PRT_MACHINEINST_PRIV*)context;
+	PrtLockMutex(priv->stateMachineLock);
+	*stats = priv->stats;
+	stats->queueDepth = priv->eventQueue.size;
+	PrtUnlockMutex(priv->stateMachineLock);
+}
+
+void PRT_CALL_CONV PrtGetProcessStats(_In_ PRT_PROCESS* process, _Out_ PRT_PROCESSSTATS* stats)
+{
+	PRT_PROCESS_PRIV* privateProcess = (PRT_PROCESS_PRIV*)process;
+
+	PrtLockMutex(privateProcess->processLock);
+	const PRT_UINT32 numMachines = privateProcess->numMachines;
+	PrtUnlockMutex(privateProcess->processLock);
+
+	stats->numMachines = numMachines;
+	stats->numEnqueues = 0;
+	stats->numDequeues = 0;
+	stats->numHandlerInvocations = 0;
+	stats->maxQueueDepth = 0;
+
+	// Machine entries never move (see the chunked machine table), so the
+	// machines created before the snapshot began can be read without holding
+	// the process lock across the whole walk.
+	for (PRT_UINT32 i = 0; i < numMachines; i++)
+	{
+		PRT_MACHINESTATS machineStats;
+		PrtGetMachineStats(PrtMachineAt(privateProcess, i), &machineStats);
+		stats->numEnqueues += machineStats.numEnqueues;
+		stats->numDequeues += machineStats.numDequeues;
+		stats->numHandlerInvocations += machineStats.numHandlerInvocations;
+		if (machineStats.maxQueueDepth > stats->maxQueueDepth)
+		{
+			stats->maxQueueDepth = machineStats.maxQueueDepth;
+		}
+	}
+}
+
 void
 PrtSend(
 	_Inout_	        PRT_MACHINESTATE* senderState,
@@ -2178,7 +3292,8 @@ PrtSend(
 	}
 	else
 	{
-		PRT_VALUE** args = PrtCalloc(numArgs, sizeof(PRT_VALUE*));
+		PRT_VALUE* inlineArgs[PRT_MAX_INLINE_ARGS];
+		PRT_VALUE** args = numArgs <= PRT_MAX_INLINE_ARGS ? inlineArgs : PrtCalloc(numArgs, sizeof(PRT_VALUE*));
 		va_list argp;
 		va_start(argp, numArgs);
 		for (PRT_UINT32 i = 0; i < numArgs; i++)
@@ -2195,7 +3310,37 @@ PrtSend(
 			PRT_TYPE* payloadType = PrtGetPayloadType((PRT_MACHINEINST_PRIV *)receiver, event);
 			payload = MakeTupleFromArray(payloadType, args);
 		}
-		PrtFree(args);
+		if (args != inlineArgs)
+		{
+			PrtFree(args);
+		}
+	}
+	PrtSendPrivate(senderState, (PRT_MACHINEINST_PRIV *)receiver, event, payload);
+}
+
+void
+PRT_CALL_CONV PrtSendEx(
+	_Inout_	        PRT_MACHINESTATE* senderState,
+	_Inout_	        PRT_MACHINEINST* receiver,
+	_In_	        PRT_VALUE* event,
+	_In_	        PRT_UINT32 numArgs,
+	_Inout_	        PRT_VALUE*** argRefs
+)
+{
+	PRT_VALUE* payload;
+	if (numArgs == 0)
+	{
+		payload = PrtMkNullValue();
+	}
+	else if (numArgs == 1)
+	{
+		payload = *argRefs[0];
+		*argRefs[0] = NULL;
+	}
+	else
+	{
+		PRT_TYPE* payloadType = PrtGetPayloadType((PRT_MACHINEINST_PRIV *)receiver, event);
+		payload = MakeTupleFromRefs(payloadType, argRefs);
 	}
 	PrtSendPrivate(senderState, (PRT_MACHINEINST_PRIV *)receiver, event, payload);
 }
@@ -2219,7 +3364,8 @@ PRT_CALL_CONV PrtSendInternal(
 	}
 	else
 	{
-		PRT_VALUE** args = PrtCalloc(numArgs, sizeof(PRT_VALUE*));
+		PRT_VALUE* inlineArgs[PRT_MAX_INLINE_ARGS];
+		PRT_VALUE** args = numArgs <= PRT_MAX_INLINE_ARGS ? inlineArgs : PrtCalloc(numArgs, sizeof(PRT_VALUE*));
 		va_list argp;
 		va_start(argp, numArgs);
 		for (PRT_UINT32 i = 0; i < numArgs; i++)
@@ -2236,12 +3382,29 @@ PRT_CALL_CONV PrtSendInternal(
 			PRT_TYPE* payloadType = PrtGetPayloadType((PRT_MACHINEINST_PRIV *)receiver, event);
 			payload = MakeTupleFromArray(payloadType, args);
 		}
-		PrtFree(args);
+		if (args != inlineArgs)
+		{
+			PrtFree(args);
+		}
 	}
 
 	PrtSendPrivate(&senderState, (PRT_MACHINEINST_PRIV *)receiver, event, payload);
 }
 
+void
+PRT_CALL_CONV PrtSendInternalEx(
+	_Inout_	        PRT_MACHINEINST* sender,
+	_Inout_	        PRT_MACHINEINST* receiver,
+	_In_	        PRT_VALUE* event,
+	_In_	        PRT_UINT32 numArgs,
+	_Inout_	        PRT_VALUE*** argRefs
+)
+{
+	PRT_MACHINESTATE senderState;
+	PrtGetMachineState(sender, &senderState);
+	PrtSendEx(&senderState, receiver, event, numArgs, argRefs);
+}
+
 static void ResizeBuffer(_Inout_ char** buffer, _Inout_ PRT_UINT32* bufferSize, _Inout_ PRT_UINT32 numCharsWritten,
 	PRT_UINT32 resizeNum)
 {
@@ -2475,11 +3638,6 @@ static void PrtUserPrintValue(_In_ PRT_VALUE* value, _Inout_ char** buffer, _Ino
 			PrtUserPrintValue(next->key, buffer, bufferSize, numCharsWritten);
 			PrtUserPrintString(" --> ", buffer, bufferSize, numCharsWritten);
 			PrtUserPrintValue(next->value, buffer, bufferSize, numCharsWritten);
-			if (next->bucketNext != NULL)
-			{
-				PrtUserPrintString("*", buffer, bufferSize, numCharsWritten);
-			}
-
 			if (next->insertNext != NULL)
 			{
 				PrtUserPrintString(", ", buffer, bufferSize, numCharsWritten);
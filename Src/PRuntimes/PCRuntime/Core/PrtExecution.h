@@ -93,8 +93,10 @@ extern "C" {
 	{
 		PRT_SCHEDULINGPOLICY_TASKNEUTRAL,
 		/**< The default policy is task neutral, meaning the caller's thread is used to run the state machine */
-		PRT_SCHEDULINGPOLICY_COOPERATIVE
+		PRT_SCHEDULINGPOLICY_COOPERATIVE,
 		/**< This policy means the caller plans to advance the state machine from a separate thread using PrtRunProcess */
+		PRT_SCHEDULINGPOLICY_WORKSTEALING
+		/**< Like cooperative, but each PrtRunProcess thread owns a ready queue and steals from the others when its own is empty */
 	} PRT_SCHEDULINGPOLICY;
 
 	/** Represents a snapshot of the state of a machine at a given point in time.  This is useful for logging.
@@ -107,6 +109,26 @@ extern "C" {
 		PRT_STRING stateName; /**< the name of the machine type */
 	} PRT_MACHINESTATE;
 
+	/** A snapshot of one machine's runtime counters (see PrtGetMachineStats). */
+	typedef struct PRT_MACHINESTATS
+	{
+		PRT_UINT64 numEnqueues; /**< Events enqueued to this machine's queue            */
+		PRT_UINT64 numDequeues; /**< Events dequeued from this machine's queue          */
+		PRT_UINT64 numHandlerInvocations; /**< Handler functions invoked on this machine */
+		PRT_UINT32 maxQueueDepth; /**< The highest queue occupancy observed so far      */
+		PRT_UINT32 queueDepth; /**< The queue occupancy at the time of the snapshot     */
+	} PRT_MACHINESTATS;
+
+	/** Counters aggregated over every machine of a process (see PrtGetProcessStats). */
+	typedef struct PRT_PROCESSSTATS
+	{
+		PRT_UINT32 numMachines; /**< The number of machines created in the process      */
+		PRT_UINT64 numEnqueues; /**< Events enqueued across all machines                */
+		PRT_UINT64 numDequeues; /**< Events dequeued across all machines                */
+		PRT_UINT64 numHandlerInvocations; /**< Handler functions invoked across all machines */
+		PRT_UINT32 maxQueueDepth; /**< The highest queue occupancy observed on any machine */
+	} PRT_PROCESSSTATS;
+
 	/** An error function that will be called whenever an error arises. */
 	typedef void (PRT_CALL_CONV * PRT_ERROR_FUN)(PRT_STATUS, PRT_MACHINEINST*);
 
@@ -134,13 +156,64 @@ extern "C" {
 //
 #define PRT_QUEUE_LEN_DEFAULT 64
 
+//
+// Capacity of the per-queue cache of recycled scalar value boxes
+//
+#define PRT_QUEUE_RECYCLE_MAX 16
+
+//
+// Length the event queue shrinks back to when an idle machine hibernates
+//
+#define PRT_QUEUE_LEN_HIBERNATED 8
+
+	struct PRT_MACHINEINST_PRIV; /* forward declaration */
+
+	/** One slot of the ordered-delivery table kept per machine for
+	* PrtEnqueueInOrder: the sender's id and the last sequence number
+	* received from it. A machineId of 0 marks an empty slot.
+	*/
+	typedef struct PRT_RECVSLOT
+	{
+		PRT_MACHINEID source;
+		PRT_INT64 lastSeqNum;
+	} PRT_RECVSLOT;
+
+//
+// Number of per-worker ready queues used by the work-stealing policy
+//
+#define PRT_MAX_WORKSTEALING_WORKERS 16
+
+	/** A per-worker ready queue used by the work-stealing scheduling policy. */
+	typedef struct PRT_WORKERQUEUE
+	{
+		PRT_RECURSIVE_MUTEX lock; /* guards head and tail of this queue only */
+		struct PRT_MACHINEINST_PRIV* head; /* FIFO queue of machines with pending work */
+		struct PRT_MACHINEINST_PRIV* tail; /* tail of the queue */
+	} PRT_WORKERQUEUE;
+
 	typedef struct PRT_COOPERATIVE_SCHEDULER
 	{
 		PRT_SEMAPHORE workAvailable; /* semaphore to signal blocked PrtRunProcess threads */
 		PRT_UINT32 threadsWaiting; /* number of PrtRunProcess threads waiting for work */
 		PRT_SEMAPHORE allThreadsStopped; /* all PrtRunProcess threads have terminated */
+		struct PRT_MACHINEINST_PRIV* readyQueueHead; /* FIFO queue of machines with pending work (guarded by processLock) */
+		struct PRT_MACHINEINST_PRIV* readyQueueTail; /* tail of the ready queue */
+		PRT_UINT32 nextWorker; /* next worker slot to hand out (work-stealing only, guarded by processLock) */
+		PRT_WORKERQUEUE* workerQueues; /* per-worker ready queues (work-stealing only) */
 	} PRT_COOPERATIVE_SCHEDULER;
 
+//
+// Machines are stored in fixed-size chunks indexed through a chunk directory,
+// so PrtGetMachine is a wait-free two-level lookup and machine creation never
+// relocates an existing entry. When the directory fills it is copied and
+// republished; outgrown directories are retired rather than freed because a
+// lock-free reader may still be indexing through one, and are reclaimed when
+// the process stops.
+//
+#define PRT_MACHINE_CHUNK_SIZE 1024
+#define PRT_MACHINE_DIR_INIT_CAPACITY 8
+#define PRT_MACHINE_MAX_RETIRED_DIRS 32
+
 	typedef struct PRT_PROCESS_PRIV
 	{
 		PRT_GUID guid;
@@ -148,8 +221,11 @@ extern "C" {
 		PRT_LOG_FUN logHandler;
 		PRT_RECURSIVE_MUTEX processLock;
 		PRT_UINT32 numMachines;
-		PRT_UINT32 machineCount;
-		PRT_MACHINEINST** machines;
+		PRT_UINT32 machineChunkCount; /* chunks allocated in the directory */
+		PRT_UINT32 machineChunkCapacity; /* slots in the chunk directory */
+		PRT_MACHINEINST*** machineChunks; /* the chunk directory */
+		PRT_MACHINEINST*** retiredMachineDirs[PRT_MACHINE_MAX_RETIRED_DIRS]; /* outgrown directories, freed on stop */
+		PRT_UINT32 numRetiredMachineDirs;
 		PRT_BOOLEAN terminating; /* PrtStopProcess has been called */
 		PRT_SCHEDULINGPOLICY schedulingPolicy;
 		void* schedulerInfo; /* for example, this could be PRT_COOPERATIVE_SCHEDULER */
@@ -191,8 +267,24 @@ extern "C" {
 		PRT_UINT32 headIndex;
 		PRT_UINT32 tailIndex;
 		PRT_UINT32 size;
+		PRT_UINT32* eventCounts; /**< Per-event-index occupancy counts (program->nEvents entries) */
+		PRT_VALUE* recycled[PRT_QUEUE_RECYCLE_MAX]; /**< Scalar value boxes recycled from dequeued triggers/payloads */
+		PRT_UINT32 nRecycled; /**< Number of live entries in recycled */
 	} PRT_EVENTQUEUE;
 
+	/** One pending send on a machine's lock-free inbox (PRT_USE_LOCKFREE_INBOX):
+	* senders push nodes with an atomic compare-and-swap and the receiving
+	* machine drains them into its event queue under its own lock.
+	*/
+	typedef struct PRT_INBOXNODE
+	{
+		PRT_VALUE* trigger; /**< The event (owned by the node until drained) */
+		PRT_VALUE* payload; /**< The payload (owned by the node until drained) */
+		PRT_MACHINESTATE state; /**< The sender's state, valid when hasState is set */
+		PRT_BOOLEAN hasState; /**< Whether the sender supplied its state */
+		struct PRT_INBOXNODE* next; /**< The next (earlier) pending send */
+	} PRT_INBOXNODE;
+
 	typedef struct PRT_STATESTACK_INFO
 	{
 		PRT_UINT32 stateIndex;
@@ -223,8 +315,11 @@ extern "C" {
 		// Machine fields (as defined in P source)
 		PRT_VALUE** varValues;
 
-		// Distributed
-		PRT_VALUE* recvMap;
+		// Distributed: open-addressing table from sender machine id to the
+		// last sequence number received, used by PrtEnqueueInOrder
+		struct PRT_RECVSLOT* recvTable;
+		PRT_UINT32 recvTableCapacity;
+		PRT_UINT32 recvTableCount;
 
 		// Machine execution management
 		PRT_OPERATION operation;
@@ -238,10 +333,16 @@ extern "C" {
 		PRT_UINT32 currentState;
 		PRT_STATESTACK callStack;
 		PRT_EVENTQUEUE eventQueue;
+		// Lock-free sender inbox (PRT_USE_LOCKFREE_INBOX); drained into
+		// eventQueue before each dequeue
+		PRT_INBOXNODE* volatile inboxHead;
 		PRT_UINT32* inheritedDeferredSetCompact;
 		PRT_UINT32* currentDeferredSetCompact;
 		PRT_UINT32* inheritedActionSetCompact;
 		PRT_UINT32* currentActionSetCompact;
+		PRT_UINT32* stateStackSetSlab; /**< Preallocated per-frame inherited-set buffers for the state stack */
+		PRT_UINT8* arena; /**< One allocation backing the machine's fixed-size buffers (freed whole on cleanup) */
+		PRT_UINT32 arenaSize; /**< The size of arena in bytes */
 		PRT_UINT32 interfaceBound;
 
 		// Extended return info
@@ -252,7 +353,15 @@ extern "C" {
 		void* receiveResumption;
 		PRT_UINT32* receiveAllowedEvents; // TODO: redundant
 		PRT_UINT32* packedReceiveCases; // keep this one.
+		PRT_RECEIVEDECL* pendingReceive; // stackless receive awaiting a matching event (NULL if none)
 		PRT_VALUE** handlerArguments;
+
+		// Ready queue links (guarded by the owner process' processLock)
+		struct PRT_MACHINEINST_PRIV* readyNext;
+		PRT_BOOLEAN isInReadyQueue;
+
+		// Runtime counters (guarded by stateMachineLock)
+		PRT_MACHINESTATS stats;
 	} PRT_MACHINEINST_PRIV;
 
 	/** Starts a new Process running program.
@@ -286,6 +395,16 @@ extern "C" {
 	*/
 	PRT_API void PRT_CALL_CONV PrtSetSchedulingPolicy(_In_ PRT_PROCESS* process, _In_ PRT_SCHEDULINGPOLICY policy);
 
+	/** Enables or disables idle hibernation for a machine type. Hibernation is
+	*   enabled by default: when a machine of the type drains its queue and leaves
+	*   the scheduler, heap-grown queue storage is shrunk back to a minimal size
+	*   and regrown lazily on the next send. Disable it for hot machine types
+	*   whose queues should keep their high-water storage.
+	*   @param[in] machineIndex The index of the machine type in the installed program.
+	*   @param[in] enable PRT_TRUE to allow hibernation, PRT_FALSE to exempt the type.
+	*/
+	PRT_API void PRT_CALL_CONV PrtSetMachineHibernation(_In_ PRT_UINT32 machineIndex, _In_ PRT_BOOLEAN enable);
+
 	/** Call this method if you set PRT_SCHEDULINGPOLICY to Cooperative.  This means the caller wants to control which thread
 	*   runs the state machine, where this thread will block when there is no work to do, and it will automatically wake up
 	*   via a semaphore when there is work to do.  It will terminate when you call PrtStopProcess.  You must then ensure you
@@ -365,6 +484,22 @@ extern "C" {
 		_In_	        PRT_UINT32 numArgs,
 		...);
 
+	/** Non-varargs variant of PrtMkMachine taking an array of argument references.
+	* Each argument is consumed (its reference is set to NULL) and the payload
+	* tuple is built in place, so marshalling does not allocate.
+	* @param[in,out] process    The process that will own this machine.
+	* @param[in]     interfaceName	interface machine to be created.
+	* @param[in]     numArgs The number of arguments in argRefs.
+	* @param[in,out] argRefs References to the payload arguments (consumed).
+	* @returns       A pointer to a PRT_MACHINEINST.
+	* @see PrtMkMachine
+	*/
+	PRT_API PRT_MACHINEINST* PRT_CALL_CONV PrtMkMachineEx(
+		_Inout_	        PRT_PROCESS* process,
+		_In_	        PRT_UINT32 interfaceName,
+		_In_	        PRT_UINT32 numArgs,
+		_Inout_	        PRT_VALUE*** argRefs);
+
 	/** Creates a new machine instance in process. Will be freed when process is stopped.
 	* @param[in,out] process    The process that will own this machine.
 	* @param[in]     context	context of the creator machine.
@@ -380,6 +515,23 @@ extern "C" {
 		...
 	);
 
+	/** Non-varargs variant of PrtMkInterface taking an array of argument references.
+	* Each argument is consumed (its reference is set to NULL) and the payload
+	* tuple is built in place, so marshalling does not allocate.
+	* @param[in]     context	context of the creator machine.
+	* @param[in]     interfaceName	interface machine to be created.
+	* @param[in]     numArgs The number of arguments in argRefs.
+	* @param[in,out] argRefs References to the payload arguments (consumed).
+	* @returns       A pointer to a PRT_MACHINEINST.
+	* @see PrtMkInterface
+	*/
+	PRT_API PRT_MACHINEINST* PRT_CALL_CONV PrtMkInterfaceEx(
+		_In_	     PRT_MACHINEINST* context,
+		_In_	     PRT_UINT32 interfaceName,
+		_In_	     PRT_UINT32 numArgs,
+		_Inout_	     PRT_VALUE*** argRefs
+	);
+
 	/** Gets machine instance corresponding to id in process.
 	* @param[in] process    The process containing the machine id.
 	* @param[in] id  The id of the machine.
@@ -401,6 +553,24 @@ extern "C" {
 		_In_	     PRT_MACHINEINST* context,
 		_Inout_	     PRT_MACHINESTATE* state);
 
+	/** Takes a consistent snapshot of the machine's runtime counters.
+	* @param[in] context  The machine to read the counters of.
+	* @param[out] stats   The counters are written to the fields of this structure.
+	* @see PRT_MACHINESTATS
+	*/
+	PRT_API void PRT_CALL_CONV PrtGetMachineStats(
+		_In_	     PRT_MACHINEINST* context,
+		_Out_	     PRT_MACHINESTATS* stats);
+
+	/** Aggregates the runtime counters of every machine in the process.
+	* @param[in] process  The process to read the counters of.
+	* @param[out] stats   The aggregated counters are written to the fields of this structure.
+	* @see PRT_PROCESSSTATS
+	*/
+	PRT_API void PRT_CALL_CONV PrtGetProcessStats(
+		_In_	     PRT_PROCESS* process,
+		_Out_	     PRT_PROCESSSTATS* stats);
+
 	/** Sends message to P state machine.
 	* @param[in] senderState The current state of the sender machine (this state will be passed through to the PRT_STEP_DEQUEUE in logging
 	* so you can figure out at that time where the event came from).
@@ -416,6 +586,24 @@ extern "C" {
 		...
 	);
 
+	/** Non-varargs variant of PrtSend taking an array of argument references.
+	* Each argument is consumed (its reference is set to NULL) and the payload
+	* tuple is built in place, so marshalling does not allocate.
+	* @param[in] senderState The current state of the sender machine.
+	* @param[in,out] receiver The machine that will receive this message.
+	* @param[in] evt The event to send with this message (cloned, user frees).
+	* @param[in] numArgs The number of arguments in argRefs.
+	* @param[in,out] argRefs References to the payload arguments (consumed).
+	* @see PrtSend
+	*/
+	PRT_API void PRT_CALL_CONV PrtSendEx(
+		_Inout_	     PRT_MACHINESTATE* senderState,
+		_Inout_	     PRT_MACHINEINST* receiver,
+		_In_	     PRT_VALUE* evt,
+		_In_	     PRT_UINT32 numArgs,
+		_Inout_	     PRT_VALUE*** argRefs
+	);
+
 	/** Sends message to P state machine.  This is for internal use only.
 	* @param[in] sender The sender machine (from which we compute the PRT_MACHINESTATE) for PrtSend.
 	* @param[in,out] receiver The machine that will receive this message.
@@ -430,6 +618,51 @@ extern "C" {
 		...
 	);
 
+	/** Non-varargs variant of PrtSendInternal taking an array of argument references.
+	* This is the entry point targeted by generated code; each argument is consumed
+	* (its reference is set to NULL) and the payload tuple is built in place, so
+	* marshalling does not allocate.
+	* @param[in] sender The sender machine (from which we compute the PRT_MACHINESTATE) for PrtSend.
+	* @param[in,out] receiver The machine that will receive this message.
+	* @param[in] evt The event to send with this message (cloned, user frees).
+	* @param[in] numArgs The number of arguments in argRefs.
+	* @param[in,out] argRefs References to the payload arguments (consumed).
+	* @see PrtSendInternal
+	*/
+	PRT_API void PRT_CALL_CONV PrtSendInternalEx(
+		_Inout_	        PRT_MACHINEINST* sender,
+		_Inout_	        PRT_MACHINEINST* receiver,
+		_In_	        PRT_VALUE* evt,
+		_In_	        PRT_UINT32 numArgs,
+		_Inout_	        PRT_VALUE*** argRefs
+	);
+
+	/** One event/payload pair of a batched send. */
+	typedef struct PRT_SENDITEM
+	{
+		PRT_VALUE* event; /**< The event to send (not cloned; ownership passes to the queue) */
+		PRT_VALUE* payload; /**< The payload to send (not cloned; ownership passes to the queue) */
+	} PRT_SENDITEM;
+
+	/** Sends a batch of messages to one P state machine. The receiver's lock is
+	* taken once and queue space for the whole batch is reserved in one shot, so
+	* fan-out bursts do not pay the mutex and wakeup cost per message. The
+	* receiver is scheduled once after the batch is enqueued. The batch is
+	* all-or-nothing: queue capacity and per-event max-instance limits are
+	* validated for every item before the first one is enqueued, and on a
+	* rejected batch every item is freed before the error is reported.
+	* @param[in] senderState The current state of the sender machine (passed through to PRT_STEP_DEQUEUE logging).
+	* @param[in,out] receiver The machine that will receive these messages.
+	* @param[in] numItems The number of event/payload pairs in items.
+	* @param[in,out] items The messages to enqueue, in order.
+	*/
+	PRT_API void PRT_CALL_CONV PrtSendBatch(
+		_In_	     PRT_MACHINESTATE* senderState,
+		_Inout_	     PRT_MACHINEINST* receiver,
+		_In_	     PRT_UINT32 numItems,
+		_Inout_	     PRT_SENDITEM* items
+	);
+
 	/** Sets a global variable to variable
 	* @param[in,out] context The context to modify.
 	* @param[in] varIndex The index of the variable to modify.
@@ -768,6 +1001,21 @@ extern "C" {
 			_Out_	        PRT_VALUE** payload
 		);
 
+	/** Registers a stackless receive: the calling handler must return immediately
+	* afterwards, and when a matching event is dequeued the corresponding case
+	* function is run as a fresh handler with the event's payload. Unlike
+	* PrtReceiveAsync this captures no stack continuation, so it works on
+	* platforms without libhandler support, but the continuation of the receive
+	* must live in the case functions.
+	* @param[in,out] receiver The machine blocking on the receive.
+	* @param[in] receiveDecl The cases to wait for (program declaration, not freed).
+	*/
+	PRT_API void PRT_CALL_CONV
+		PrtReceiveCases(
+			_Inout_	        PRT_MACHINEINST* receiver,
+			_In_	        PRT_RECEIVEDECL* receiveDecl
+		);
+
 	PRT_API void
 		PrtRunStateMachine(
 			_Inout_	PRT_MACHINEINST_PRIV* context
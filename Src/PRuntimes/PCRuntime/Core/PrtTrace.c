@@ -0,0 +1,185 @@
+#include "PrtTrace.h"
+
+/* Each thread that takes steps owns one single-producer ring; the drainer is
+ * the single consumer of every ring. Producers publish records by storing the
+ * record and then advancing the tail with a release barrier, so recording
+ * never takes a lock. Rings are registered on a global list the first time a
+ * thread traces and are never unregistered; a ring whose thread has exited
+ * simply stops producing. */
+
+typedef struct PRT_TRACE_RING
+{
+	PRT_TRACE_RECORD records[PRT_TRACE_RING_CAPACITY];
+	volatile PRT_UINT64 head; /**< Next record to drain (consumer-owned)  */
+	volatile PRT_UINT64 tail; /**< Next record to write (producer-owned)  */
+	PRT_UINT64 dropped; /**< Records dropped because the ring was full */
+	struct PRT_TRACE_RING* next; /**< Next ring on the global registry list */
+} PRT_TRACE_RING;
+
+static PRT_TRACE_RING* volatile prtTraceRings = NULL;
+static PRT_THREAD_LOCAL PRT_TRACE_RING* prtTraceThreadRing = NULL;
+
+#if defined(PRT_USE_GCC) || defined(PRT_USE_CLANG)
+#define PrtTraceReleaseBarrier() __sync_synchronize()
+#elif defined(PRT_PLAT_WINUSER)
+#define PrtTraceReleaseBarrier() MemoryBarrier()
+#else
+#define PrtTraceReleaseBarrier() ((void)0)
+#endif
+
+static PRT_UINT64 PrtTraceTimestamp(void)
+{
+#if defined(PRT_PLAT_WINUSER)
+	return (PRT_UINT64)GetTickCount64() * 1000000;
+#elif defined(PRT_PLAT_LINUXUSER) || defined(PRT_PLAT_NUTTXUSER)
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (PRT_UINT64)ts.tv_sec * 1000000000 + (PRT_UINT64)ts.tv_nsec;
+#else
+	//// No monotonic clock available; a per-process sequence still orders records.
+	static volatile PRT_UINT64 sequence = 0;
+	return ++sequence;
+#endif
+}
+
+static PRT_TRACE_RING* PrtTraceGetRing(void)
+{
+	PRT_TRACE_RING* ring = prtTraceThreadRing;
+	if (ring != NULL)
+	{
+		return ring;
+	}
+
+	ring = (PRT_TRACE_RING *)PrtCalloc(1, sizeof(PRT_TRACE_RING));
+	prtTraceThreadRing = ring;
+
+	//// Register on the global list; racing threads each push their own ring.
+#if defined(PRT_USE_GCC) || defined(PRT_USE_CLANG)
+	do
+	{
+		ring->next = prtTraceRings;
+	}
+	while (!__sync_bool_compare_and_swap(&prtTraceRings, ring->next, ring));
+#elif defined(PRT_PLAT_WINUSER)
+	for (;;)
+	{
+		PRT_TRACE_RING* expected = prtTraceRings;
+		ring->next = expected;
+		if (InterlockedCompareExchangePointer((PVOID volatile *)&prtTraceRings, ring, expected) == expected)
+		{
+			break;
+		}
+	}
+#else
+	ring->next = prtTraceRings;
+	prtTraceRings = ring;
+#endif
+	return ring;
+}
+
+void PRT_CALL_CONV PrtTraceStep(
+	_In_	     PRT_STEP step,
+	_In_	     PRT_UINT32 machineId,
+	_In_	     PRT_UINT32 stateId,
+	_In_	     PRT_UINT32 eventIndex
+)
+{
+	PRT_TRACE_RING* ring = PrtTraceGetRing();
+	if (ring->tail - ring->head == PRT_TRACE_RING_CAPACITY)
+	{
+		ring->dropped++;
+		return;
+	}
+
+	PRT_TRACE_RECORD* record = &ring->records[ring->tail % PRT_TRACE_RING_CAPACITY];
+	record->timestamp = PrtTraceTimestamp();
+	record->step = (PRT_UINT32)step;
+	record->machineId = machineId;
+	record->stateId = stateId;
+	record->eventIndex = eventIndex;
+
+	//// Publish the record before advancing the tail
+	PrtTraceReleaseBarrier();
+	ring->tail = ring->tail + 1;
+}
+
+PRT_UINT32 PRT_CALL_CONV PrtTraceDrain(
+	_In_	     PRT_TRACE_DRAIN_FUN drainFun,
+	_Inout_	     void* drainContext
+)
+{
+	PRT_UINT32 nDrained = 0;
+	for (PRT_TRACE_RING* ring = prtTraceRings; ring != NULL; ring = ring->next)
+	{
+		while (ring->head != ring->tail)
+		{
+			drainFun(&ring->records[ring->head % PRT_TRACE_RING_CAPACITY], drainContext);
+			PrtTraceReleaseBarrier();
+			ring->head = ring->head + 1;
+			nDrained++;
+		}
+	}
+
+	return nDrained;
+}
+
+PRT_UINT64 PRT_CALL_CONV PrtTraceGetDroppedCount(void)
+{
+	PRT_UINT64 dropped = 0;
+	for (PRT_TRACE_RING* ring = prtTraceRings; ring != NULL; ring = ring->next)
+	{
+		dropped += ring->dropped;
+	}
+
+	return dropped;
+}
+
+static const char* PrtTraceStepName(_In_ PRT_UINT32 step)
+{
+	switch ((PRT_STEP)step)
+	{
+	case PRT_STEP_CREATE: return "CreateLog";
+	case PRT_STEP_DEQUEUE: return "DequeueLog";
+	case PRT_STEP_DO: return "ActionLog";
+	case PRT_STEP_ENQUEUE: return "EnqueueLog";
+	case PRT_STEP_ENTRY: return "StateLog";
+	case PRT_STEP_EXIT: return "ExitLog";
+	case PRT_STEP_GOTO: return "GotoLog";
+	case PRT_STEP_HALT: return "HaltLog";
+	case PRT_STEP_POP: return "PopLog";
+	case PRT_STEP_PUSH: return "PushLog";
+	case PRT_STEP_RAISE: return "RaiseLog";
+	case PRT_STEP_IGNORE: return "IgnoreLog";
+	case PRT_STEP_UNHANDLED: return "UnhandledLog";
+	default: return "UnknownLog";
+	}
+}
+
+PRT_UINT32 PRT_CALL_CONV PrtTraceDecodeRecord(
+	_In_	     const PRT_TRACE_RECORD* record,
+	_Out_	     char* buffer,
+	_In_	     PRT_UINT32 bufferSize
+)
+{
+	int written;
+	if (record->eventIndex == PRT_TRACE_NO_EVENT)
+	{
+		written = snprintf(buffer, bufferSize, "<%s> Machine (%u) in state %u at %llu\n",
+			PrtTraceStepName(record->step), record->machineId, record->stateId,
+			(unsigned long long)record->timestamp);
+	}
+	else if (program != NULL && record->eventIndex < program->nEvents)
+	{
+		written = snprintf(buffer, bufferSize, "<%s> Machine (%u) in state %u event %s at %llu\n",
+			PrtTraceStepName(record->step), record->machineId, record->stateId,
+			program->events[record->eventIndex]->name, (unsigned long long)record->timestamp);
+	}
+	else
+	{
+		written = snprintf(buffer, bufferSize, "<%s> Machine (%u) in state %u event %u at %llu\n",
+			PrtTraceStepName(record->step), record->machineId, record->stateId,
+			record->eventIndex, (unsigned long long)record->timestamp);
+	}
+
+	return written < 0 ? 0 : (PRT_UINT32)written;
+}
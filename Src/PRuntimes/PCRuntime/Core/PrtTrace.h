@@ -0,0 +1,83 @@
+/**
+* \file PrtTrace.h
+* \brief Binary ring-buffer tracing backend for runtime steps.
+* The string-building log path (PrtLog -> PRT_LOG_FUN) is too expensive to
+* leave enabled in production. This backend records a fixed-size binary
+* record per PRT_STEP into a lock-free per-thread ring buffer, cheap enough
+* to stay always on. A drain API hands the records to a consumer, and a
+* decoder renders them offline in the spirit of the existing log strings.
+*/
+#ifndef PRTTRACE_H
+#define PRTTRACE_H
+
+#include "PrtExecution.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+	/** The number of records each per-thread trace ring can hold (power of two). */
+#define PRT_TRACE_RING_CAPACITY 8192
+
+	/** The event index recorded for steps that carry no event. */
+#define PRT_TRACE_NO_EVENT 0xffffffff
+
+	/** A fixed-size binary record of one runtime step. */
+	typedef struct PRT_TRACE_RECORD
+	{
+		PRT_UINT64 timestamp; /**< Monotonic timestamp in nanoseconds (platform permitting) */
+		PRT_UINT32 step; /**< The PRT_STEP kind                                */
+		PRT_UINT32 machineId; /**< The id of the machine that took the step         */
+		PRT_UINT32 stateId; /**< The machine's current state index                */
+		PRT_UINT32 eventIndex; /**< The event index, or PRT_TRACE_NO_EVENT           */
+	} PRT_TRACE_RECORD;
+
+	/** A consumer callback invoked once per drained record. */
+	typedef void (PRT_CALL_CONV * PRT_TRACE_DRAIN_FUN)(_In_ const PRT_TRACE_RECORD* record, _Inout_ void* drainContext);
+
+	/** Records one step into the calling thread's trace ring.
+	*   Wait-free on GCC/Clang; when the ring is full the record is dropped and counted.
+	*   @param[in] step The step kind.
+	*   @param[in] machineId The id of the machine taking the step.
+	*   @param[in] stateId The machine's current state index.
+	*   @param[in] eventIndex The event index, or PRT_TRACE_NO_EVENT.
+	*/
+	PRT_API void PRT_CALL_CONV PrtTraceStep(
+		_In_	     PRT_STEP step,
+		_In_	     PRT_UINT32 machineId,
+		_In_	     PRT_UINT32 stateId,
+		_In_	     PRT_UINT32 eventIndex
+	);
+
+	/** Drains all per-thread trace rings, invoking drainFun once per record in
+	*   ring order. Only one thread may drain at a time.
+	*   @param[in] drainFun The consumer callback.
+	*   @param[in] drainContext Opaque context passed through to drainFun.
+	*   @returns The number of records drained.
+	*/
+	PRT_API PRT_UINT32 PRT_CALL_CONV PrtTraceDrain(
+		_In_	     PRT_TRACE_DRAIN_FUN drainFun,
+		_Inout_	     void* drainContext
+	);
+
+	/** Returns the total number of records dropped because a ring was full. */
+	PRT_API PRT_UINT64 PRT_CALL_CONV PrtTraceGetDroppedCount(void);
+
+	/** Decodes one record into the existing human-readable log vocabulary.
+	*   Uses the installed program's machine/event/state names when available,
+	*   falling back to numeric indexes.
+	*   @param[in] record The record to decode.
+	*   @param[out] buffer The output buffer.
+	*   @param[in] bufferSize The size of buffer in characters.
+	*   @returns The number of characters written (excluding the terminator).
+	*/
+	PRT_API PRT_UINT32 PRT_CALL_CONV PrtTraceDecodeRecord(
+		_In_	     const PRT_TRACE_RECORD* record,
+		_Out_	     char* buffer,
+		_In_	     PRT_UINT32 bufferSize
+	);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
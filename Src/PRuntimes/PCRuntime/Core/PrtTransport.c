@@ -0,0 +1,342 @@
+#include "PrtTransport.h"
+
+//
+// The ring holds variable-length records, each an 8-byte header followed by
+// the record bytes, with every record rounded up to 8 bytes so headers stay
+// aligned. Senders reserve space by advancing tail with a compare-and-swap,
+// fill the record, and only then publish it by storing the committed state;
+// the consumer stops at the first unpublished header, so a slow sender never
+// lets a later record be delivered out of order. The consumer zeroes each
+// header before advancing head past it, which keeps the invariant that every
+// byte at or beyond tail reads as state PRT_TRANSPORT_FREE. A record that
+// would straddle the end of the buffer is preceded by a padding record that
+// covers the rest of the lap.
+//
+
+#define PRT_TRANSPORT_FREE 0
+#define PRT_TRANSPORT_COMMITTED 1
+#define PRT_TRANSPORT_PADDING 2
+
+#define PRT_TRANSPORT_ALIGN(x) (((x) + 7) & ~(PRT_UINT32)7)
+
+typedef struct PRT_TRANSPORT_RECORD
+{
+	volatile PRT_UINT32 state;
+	PRT_UINT32 length;
+} PRT_TRANSPORT_RECORD;
+
+typedef struct PRT_TRANSPORT_PEER
+{
+	PRT_GUID processId;
+	PRT_TRANSPORT_RING* ring;
+} PRT_TRANSPORT_PEER;
+
+// Like the installed program, the transport assumes one process per address
+// space: one inbound ring, plus the rings of every connected destination.
+// Peers are only added by PrtTransportConnect, which must happen before the
+// first PrtSendRemote to that destination; after that the table is read-only,
+// so sends on concurrent threads scan it without a lock.
+static PRT_PROCESS* prtListeningProcess = NULL;
+static PRT_TRANSPORT_RING* prtInboundRing = NULL;
+static PRT_TRANSPORT_PEER prtTransportPeers[PRT_TRANSPORT_MAX_PEERS];
+static PRT_UINT32 prtNumTransportPeers = 0;
+
+#if defined(PRT_USE_GCC) || defined(PRT_USE_CLANG)
+
+static volatile PRT_INT32 prtTransportDraining = 0;
+
+PRT_API PRT_BOOLEAN PRT_CALL_CONV
+PrtTransportListen(_In_ PRT_PROCESS* process)
+{
+	PrtAssert(process != NULL, "Invalid process");
+	PrtAssert(prtInboundRing == NULL, "Process is already listening");
+	PRT_TRANSPORT_RING* ring = (PRT_TRANSPORT_RING *)PrtTransportMapRing(
+		process->guid, PRT_TRANSPORT_RING_BYTES, PRT_TRUE);
+	if (ring == NULL)
+	{
+		return PRT_FALSE;
+	}
+	ring->capacity = PRT_TRANSPORT_RING_BYTES - (PRT_UINT32)offsetof(PRT_TRANSPORT_RING, data);
+	ring->capacity &= ~(PRT_UINT32)7;
+	ring->head = 0;
+	ring->tail = 0;
+	//// Publish the capacity and cursors before the magic value; a sender that
+	//// sees the magic must also see an initialized ring.
+	__sync_synchronize();
+	ring->magic = PRT_TRANSPORT_MAGIC;
+	prtListeningProcess = process;
+	prtInboundRing = ring;
+	return PRT_TRUE;
+}
+
+PRT_API PRT_BOOLEAN PRT_CALL_CONV
+PrtTransportConnect(_In_ PRT_GUID processId)
+{
+	for (PRT_UINT32 i = 0; i < prtNumTransportPeers; i++)
+	{
+		if (PrtAreGuidsEqual(prtTransportPeers[i].processId, processId))
+		{
+			return PRT_TRUE;
+		}
+	}
+	PrtAssert(prtNumTransportPeers < PRT_TRANSPORT_MAX_PEERS, "Too many transport peers");
+	PRT_TRANSPORT_RING* ring = (PRT_TRANSPORT_RING *)PrtTransportMapRing(
+		processId, PRT_TRANSPORT_RING_BYTES, PRT_FALSE);
+	if (ring == NULL || ring->magic != PRT_TRANSPORT_MAGIC)
+	{
+		if (ring != NULL)
+		{
+			PrtTransportUnmapRing(ring, PRT_TRANSPORT_RING_BYTES, processId, PRT_FALSE);
+		}
+		return PRT_FALSE;
+	}
+	prtTransportPeers[prtNumTransportPeers].processId = processId;
+	prtTransportPeers[prtNumTransportPeers].ring = ring;
+	prtNumTransportPeers++;
+	return PRT_TRUE;
+}
+
+// Reserves alignedBytes of record space (header included) at the tail of the
+// ring and returns its header, or NULL when the ring is too full. When the
+// space before the end of the buffer is too small, the rest of the lap is
+// reserved too and published as a padding record.
+static PRT_TRANSPORT_RECORD*
+PrtTransportReserve(_Inout_ PRT_TRANSPORT_RING* ring, _In_ PRT_UINT32 alignedBytes)
+{
+	for (;;)
+	{
+		PRT_UINT64 tail = ring->tail;
+		PRT_UINT64 head = ring->head;
+		PRT_UINT32 offset = (PRT_UINT32)(tail % ring->capacity);
+		PRT_UINT32 bytesToEnd = ring->capacity - offset;
+		PRT_UINT32 padding = alignedBytes <= bytesToEnd ? 0 : bytesToEnd;
+		if (tail + padding + alignedBytes > head + ring->capacity)
+		{
+			return NULL;
+		}
+		if (!__sync_bool_compare_and_swap(&ring->tail, tail, tail + padding + alignedBytes))
+		{
+			continue;
+		}
+		if (padding != 0)
+		{
+			PRT_TRANSPORT_RECORD* pad = (PRT_TRANSPORT_RECORD *)(ring->data + offset);
+			pad->length = padding - (PRT_UINT32)sizeof(PRT_TRANSPORT_RECORD);
+			__sync_synchronize();
+			pad->state = PRT_TRANSPORT_PADDING;
+			offset = 0;
+		}
+		return (PRT_TRANSPORT_RECORD *)(ring->data + offset);
+	}
+}
+
+PRT_API PRT_BOOLEAN PRT_CALL_CONV
+PrtSendRemote(
+	_In_	     PRT_MACHINEID target,
+	_In_	     PRT_VALUE* event,
+	_In_	     PRT_VALUE* payload
+)
+{
+	PRT_TRANSPORT_RING* ring = NULL;
+	for (PRT_UINT32 i = 0; i < prtNumTransportPeers; i++)
+	{
+		if (PrtAreGuidsEqual(prtTransportPeers[i].processId, target.processId))
+		{
+			ring = prtTransportPeers[i].ring;
+			break;
+		}
+	}
+	if (ring == NULL)
+	{
+		return PRT_FALSE;
+	}
+
+	PRT_UINT32 eventBytes = PrtSerializeValue(event, NULL, 0);
+	PRT_UINT32 payloadBytes = PrtSerializeValue(payload, NULL, 0);
+	PRT_UINT32 recordBytes = (PRT_UINT32)sizeof(PRT_MACHINEID) + eventBytes + payloadBytes;
+	PRT_UINT32 alignedBytes = PRT_TRANSPORT_ALIGN((PRT_UINT32)sizeof(PRT_TRANSPORT_RECORD) + recordBytes);
+	//// A record larger than half the ring can never be reserved, no matter
+	//// how much the consumer drains; report it as a send failure so the
+	//// caller keeps ownership and can fall back to another transport.
+	if (alignedBytes > ring->capacity / 2)
+	{
+		return PRT_FALSE;
+	}
+
+	PRT_TRANSPORT_RECORD* record = PrtTransportReserve(ring, alignedBytes);
+	if (record == NULL)
+	{
+		return PRT_FALSE;
+	}
+	PRT_UINT8* cursor = (PRT_UINT8 *)(record + 1);
+	memcpy(cursor, &target, sizeof(PRT_MACHINEID));
+	cursor += sizeof(PRT_MACHINEID);
+	cursor += PrtSerializeValue(event, cursor, eventBytes);
+	PrtSerializeValue(payload, cursor, payloadBytes);
+	record->length = recordBytes;
+	//// The record bytes must be visible before the committed state is.
+	__sync_synchronize();
+	record->state = PRT_TRANSPORT_COMMITTED;
+	PrtFreeValue(event);
+	PrtFreeValue(payload);
+	return PRT_TRUE;
+}
+
+// Rebuilds one drained record and hands it to the normal local send path. A
+// remote sender has no sender state to report, which PrtSendPrivate accepts.
+static void
+PrtTransportDeliver(_In_ PRT_PROCESS* process, _In_ PRT_UINT8* buffer, _In_ PRT_UINT32 length)
+{
+	PRT_MACHINEID target;
+	memcpy(&target, buffer, sizeof(PRT_MACHINEID));
+	buffer += sizeof(PRT_MACHINEID);
+	length -= (PRT_UINT32)sizeof(PRT_MACHINEID);
+
+	PRT_UINT32 consumed = length;
+	PRT_VALUE* event = PrtDeserializeValue(buffer, &consumed);
+	buffer += consumed;
+	length -= consumed;
+	consumed = length;
+	PRT_VALUE* payload = PrtDeserializeValue(buffer, &consumed);
+
+	PRT_VALUE* id = PrtMkMachineValue(target);
+	PRT_MACHINEINST* machine = PrtGetMachine(process, id);
+	PrtFreeValue(id);
+	PrtSendPrivate(NULL, (PRT_MACHINEINST_PRIV *)machine, event, payload);
+}
+
+PRT_UINT32
+PrtTransportDrain(_In_ PRT_PROCESS* process)
+{
+	PRT_TRANSPORT_RING* ring = prtInboundRing;
+	if (ring == NULL || process != prtListeningProcess)
+	{
+		return 0;
+	}
+	if (__sync_lock_test_and_set(&prtTransportDraining, 1) != 0)
+	{
+		//// Another run thread is already draining.
+		return 0;
+	}
+	PRT_UINT32 delivered = 0;
+	while (ring->head != ring->tail)
+	{
+		PRT_UINT32 offset = (PRT_UINT32)(ring->head % ring->capacity);
+		PRT_TRANSPORT_RECORD* record = (PRT_TRANSPORT_RECORD *)(ring->data + offset);
+		PRT_UINT32 state = record->state;
+		if (state == PRT_TRANSPORT_FREE)
+		{
+			//// Reserved but not yet committed; later records must wait for it.
+			break;
+		}
+		__sync_synchronize();
+		PRT_UINT32 length = record->length;
+		if (state == PRT_TRANSPORT_COMMITTED)
+		{
+			PrtTransportDeliver(process, (PRT_UINT8 *)(record + 1), length);
+			delivered++;
+		}
+		//// Release the region back to producers before advancing head past it.
+		record->state = PRT_TRANSPORT_FREE;
+		__sync_synchronize();
+		ring->head += PRT_TRANSPORT_ALIGN((PRT_UINT32)sizeof(PRT_TRANSPORT_RECORD) + length);
+	}
+	__sync_lock_release(&prtTransportDraining);
+	return delivered;
+}
+
+PRT_BOOLEAN
+PrtTransportIsListening(void)
+{
+	return prtInboundRing != NULL ? PRT_TRUE : PRT_FALSE;
+}
+
+PRT_API void PRT_CALL_CONV
+PrtTransportShutdown(void)
+{
+	for (PRT_UINT32 i = 0; i < prtNumTransportPeers; i++)
+	{
+		PrtTransportUnmapRing(prtTransportPeers[i].ring, PRT_TRANSPORT_RING_BYTES,
+			prtTransportPeers[i].processId, PRT_FALSE);
+	}
+	prtNumTransportPeers = 0;
+	if (prtInboundRing != NULL)
+	{
+		PrtTransportUnmapRing(prtInboundRing, PRT_TRANSPORT_RING_BYTES,
+			prtListeningProcess->guid, PRT_TRUE);
+		prtInboundRing = NULL;
+		prtListeningProcess = NULL;
+	}
+}
+
+#else
+
+//// The reservation protocol needs atomics on shared memory; without a known
+//// compiler the transport reports itself unavailable.
+
+PRT_API PRT_BOOLEAN PRT_CALL_CONV
+PrtTransportListen(_In_ PRT_PROCESS* process)
+{
+	return PRT_FALSE;
+}
+
+PRT_API PRT_BOOLEAN PRT_CALL_CONV
+PrtTransportConnect(_In_ PRT_GUID processId)
+{
+	return PRT_FALSE;
+}
+
+PRT_API PRT_BOOLEAN PRT_CALL_CONV
+PrtSendRemote(
+	_In_	     PRT_MACHINEID target,
+	_In_	     PRT_VALUE* event,
+	_In_	     PRT_VALUE* payload
+)
+{
+	return PRT_FALSE;
+}
+
+PRT_UINT32
+PrtTransportDrain(_In_ PRT_PROCESS* process)
+{
+	return 0;
+}
+
+PRT_BOOLEAN
+PrtTransportIsListening(void)
+{
+	return PRT_FALSE;
+}
+
+PRT_API void PRT_CALL_CONV
+PrtTransportShutdown(void)
+{
+}
+
+#endif
+
+#if !defined(PRT_PLAT_LINUXUSER)
+
+//// Default mapping hooks for platforms without a shared-memory implementation.
+
+void*
+PrtTransportMapRing(
+	_In_	     PRT_GUID processId,
+	_In_	     PRT_UINT32 ringBytes,
+	_In_	     PRT_BOOLEAN create
+)
+{
+	return NULL;
+}
+
+void
+PrtTransportUnmapRing(
+	_In_	     void* ring,
+	_In_	     PRT_UINT32 ringBytes,
+	_In_	     PRT_GUID processId,
+	_In_	     PRT_BOOLEAN owner
+)
+{
+}
+
+#endif
@@ -0,0 +1,110 @@
+/**
+* \file PrtTransport.h
+* \brief Shared-memory transport between co-located processes.
+* Sends between two PRT_PROCESS instances on the same host used to be
+* impossible (PrtCheckIsLocalMachineId aborts with PRT_STATUS_ILLEGAL_SEND).
+* This subsystem gives each listening process a shared-memory MPSC ring;
+* senders serialize the event and payload (PrtSerializeValue) straight into
+* the destination ring, and the receiving process's PrtRunProcess loop
+* drains committed records and delivers them through PrtSendPrivate, so no
+* copy ever goes through a socket. The ring mapping itself is platform
+* work and lives behind PrtTransportMapRing/PrtTransportUnmapRing.
+*/
+#ifndef PRTTRANSPORT_H
+#define PRTTRANSPORT_H
+
+#include "PrtExecution.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+	/** The total size in bytes of one shared-memory ring mapping. */
+#define PRT_TRANSPORT_RING_BYTES (1024 * 1024)
+
+	/** Identifies a mapping as an initialized transport ring. */
+#define PRT_TRANSPORT_MAGIC 0x50525452
+
+	/** The maximum number of destination processes one process can connect to. */
+#define PRT_TRANSPORT_MAX_PEERS 16
+
+	/** The shared-memory ring header; the record bytes follow it in the same
+	*   mapping. head and tail are monotonically increasing byte cursors; the
+	*   listening process owns head, senders reserve tail with a compare-and-swap.
+	*/
+	typedef struct PRT_TRANSPORT_RING
+	{
+		PRT_UINT32 magic; /**< PRT_TRANSPORT_MAGIC once the listener initialized the ring */
+		PRT_UINT32 capacity; /**< Number of record bytes following this header        */
+		volatile PRT_UINT64 head; /**< Consumer cursor; only the listener advances it */
+		volatile PRT_UINT64 tail; /**< Producer cursor; senders advance it with CAS   */
+		PRT_UINT8 data[1]; /**< The record bytes (capacity of them)                   */
+	} PRT_TRANSPORT_RING;
+
+	/** Starts listening for inbound sends to this process: creates the process's
+	*   shared-memory ring, named after the process guid. Like the installed
+	*   program, the transport assumes one process per address space.
+	*   @param[in] process The process that should receive remote sends.
+	*   @returns PRT_TRUE if the ring was created, PRT_FALSE if the platform has no transport.
+	*/
+	PRT_API PRT_BOOLEAN PRT_CALL_CONV PrtTransportListen(_In_ PRT_PROCESS* process);
+
+	/** Opens the shared-memory ring of a destination process so PrtSendRemote
+	*   can reach it. The destination must already be listening.
+	*   @param[in] processId The guid of the destination process.
+	*   @returns PRT_TRUE if the ring was mapped, PRT_FALSE otherwise.
+	*/
+	PRT_API PRT_BOOLEAN PRT_CALL_CONV PrtTransportConnect(_In_ PRT_GUID processId);
+
+	/** Sends an event to a machine in another process over that process's ring.
+	*   On success ownership of event and payload transfers to the transport
+	*   (they are serialized and freed); on failure (no connection, or the ring
+	*   is full) the caller keeps ownership and may retry.
+	*   @param[in] target  The destination machine; its processId picks the ring.
+	*   @param[in] event   The event to send.
+	*   @param[in] payload The payload to send.
+	*   @returns PRT_TRUE if the record was committed to the ring.
+	*/
+	PRT_API PRT_BOOLEAN PRT_CALL_CONV PrtSendRemote(
+		_In_	     PRT_MACHINEID target,
+		_In_	     PRT_VALUE* event,
+		_In_	     PRT_VALUE* payload);
+
+	/** Delivers every committed record in the listening process's ring through
+	*   PrtSendPrivate. Called from the PrtRunProcess loop; safe to call from
+	*   several run threads (at most one drains at a time).
+	*   @param[in] process The listening process.
+	*   @returns The number of events delivered.
+	*/
+	PRT_UINT32 PrtTransportDrain(_In_ PRT_PROCESS* process);
+
+	/** Returns PRT_TRUE if this process called PrtTransportListen. */
+	PRT_BOOLEAN PrtTransportIsListening(void);
+
+	/** Unmaps the inbound ring and every connected destination ring. Call after
+	*   PrtStopProcess; the inbound ring's shared-memory name is removed.
+	*/
+	PRT_API void PRT_CALL_CONV PrtTransportShutdown(void);
+
+	/** Platform hook: maps (create == PRT_TRUE) or opens the shared-memory ring
+	*   named after processId. Returns NULL if the platform has no shared memory
+	*   or the ring does not exist.
+	*/
+	void* PrtTransportMapRing(
+		_In_	     PRT_GUID processId,
+		_In_	     PRT_UINT32 ringBytes,
+		_In_	     PRT_BOOLEAN create);
+
+	/** Platform hook: unmaps a ring returned by PrtTransportMapRing; when owner
+	*   is PRT_TRUE the backing shared-memory name is removed as well.
+	*/
+	void PrtTransportUnmapRing(
+		_In_	     void* ring,
+		_In_	     PRT_UINT32 ringBytes,
+		_In_	     PRT_GUID processId,
+		_In_	     PRT_BOOLEAN owner);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
@@ -142,6 +142,12 @@ PRT_BOOLEAN PRT_CALL_CONV PrtIsSubtype(_In_ PRT_TYPE* subType, _In_ PRT_TYPE* su
 	PrtAssert(PrtIsValidType(subType), "Invalid type expression");
 	PrtAssert(PrtIsValidType(supType), "Invalid type expression");
 
+	//// Subtyping is reflexive, so interned (canonical) types compare in O(1).
+	if (subType == supType)
+	{
+		return PRT_TRUE;
+	}
+
 	PRT_TYPE_KIND subKind = subType->typeKind;
 	PRT_TYPE_KIND supKind = supType->typeKind;
 	switch (supKind)
@@ -288,6 +294,156 @@ PRT_BOOLEAN PRT_CALL_CONV PrtIsSubtype(_In_ PRT_TYPE* subType, _In_ PRT_TYPE* su
 	}
 }
 
+PRT_BOOLEAN PRT_CALL_CONV PrtIsEqualType(_In_ PRT_TYPE* type1, _In_ PRT_TYPE* type2)
+{
+	PrtAssert(PrtIsValidType(type1), "Invalid type expression");
+	PrtAssert(PrtIsValidType(type2), "Invalid type expression");
+
+	//// Interned types are canonical, so equality on them is a pointer compare.
+	if (type1 == type2)
+	{
+		return PRT_TRUE;
+	}
+
+	if (type1->typeKind != type2->typeKind)
+	{
+		return PRT_FALSE;
+	}
+
+	switch (type1->typeKind)
+	{
+	case PRT_KIND_ANY:
+	case PRT_KIND_NULL:
+	case PRT_KIND_BOOL:
+	case PRT_KIND_EVENT:
+	case PRT_KIND_MACHINE:
+	case PRT_KIND_INT:
+	case PRT_KIND_FLOAT:
+	case PRT_KIND_STRING:
+	{
+		return PRT_TRUE;
+	}
+	case PRT_KIND_FOREIGN:
+	{
+		return type1->typeUnion.foreignType->declIndex == type2->typeUnion.foreignType->declIndex
+			? PRT_TRUE
+			: PRT_FALSE;
+	}
+	case PRT_KIND_MAP:
+	{
+		PRT_MAPTYPE* map1 = type1->typeUnion.map;
+		PRT_MAPTYPE* map2 = type2->typeUnion.map;
+		return
+			PrtIsEqualType(map1->domType, map2->domType) &&
+			PrtIsEqualType(map1->codType, map2->codType)
+			? PRT_TRUE
+			: PRT_FALSE;
+	}
+	case PRT_KIND_NMDTUP:
+	{
+		PRT_NMDTUPTYPE* nmdTup1 = type1->typeUnion.nmTuple;
+		PRT_NMDTUPTYPE* nmdTup2 = type2->typeUnion.nmTuple;
+		if (nmdTup1->arity != nmdTup2->arity)
+		{
+			return PRT_FALSE;
+		}
+
+		for (PRT_UINT32 i = 0; i < nmdTup1->arity; ++i)
+		{
+			if (strncmp(nmdTup1->fieldNames[i], nmdTup2->fieldNames[i], PRT_MAXFLDNAME_LENGTH) != 0)
+			{
+				return PRT_FALSE;
+			}
+		}
+
+		for (PRT_UINT32 i = 0; i < nmdTup1->arity; ++i)
+		{
+			if (!PrtIsEqualType(nmdTup1->fieldTypes[i], nmdTup2->fieldTypes[i]))
+			{
+				return PRT_FALSE;
+			}
+		}
+
+		return PRT_TRUE;
+	}
+	case PRT_KIND_SEQ:
+	{
+		return PrtIsEqualType(type1->typeUnion.seq->innerType, type2->typeUnion.seq->innerType);
+	}
+	case PRT_KIND_SET:
+	{
+		return PrtIsEqualType(type1->typeUnion.set->innerType, type2->typeUnion.set->innerType);
+	}
+	case PRT_KIND_TUPLE:
+	{
+		PRT_TUPTYPE* tup1 = type1->typeUnion.tuple;
+		PRT_TUPTYPE* tup2 = type2->typeUnion.tuple;
+		if (tup1->arity != tup2->arity)
+		{
+			return PRT_FALSE;
+		}
+
+		for (PRT_UINT32 i = 0; i < tup1->arity; ++i)
+		{
+			if (!PrtIsEqualType(tup1->fieldTypes[i], tup2->fieldTypes[i]))
+			{
+				return PRT_FALSE;
+			}
+		}
+
+		return PRT_TRUE;
+	}
+	default:
+		PrtAssert(PRT_FALSE, "PrtIsEqualType: Invalid type");
+		return PRT_FALSE;
+	}
+}
+
+//// The intern table gives every distinct type a canonical representative. It
+//// is populated from the program declaration at install time and does not own
+//// the types it points at; the program declaration does.
+static PRT_TYPE** prtInternedTypes = NULL;
+static PRT_UINT32 prtNumInternedTypes = 0;
+static PRT_UINT32 prtInternedTypesCapacity = 0;
+
+PRT_TYPE* PRT_CALL_CONV PrtInternType(_In_ PRT_TYPE* type)
+{
+	PrtAssert(PrtIsValidType(type), "Invalid type expression");
+
+	for (PRT_UINT32 i = 0; i < prtNumInternedTypes; i++)
+	{
+		if (PrtIsEqualType(prtInternedTypes[i], type))
+		{
+			return prtInternedTypes[i];
+		}
+	}
+
+	if (prtNumInternedTypes == prtInternedTypesCapacity)
+	{
+		const PRT_UINT32 newCapacity = prtInternedTypesCapacity == 0 ? 16 : 2 * prtInternedTypesCapacity;
+		PRT_TYPE** newTable = (PRT_TYPE **)PrtCalloc(newCapacity, sizeof(PRT_TYPE *));
+		for (PRT_UINT32 i = 0; i < prtNumInternedTypes; i++)
+		{
+			newTable[i] = prtInternedTypes[i];
+		}
+		PrtFree(prtInternedTypes);
+		prtInternedTypes = newTable;
+		prtInternedTypesCapacity = newCapacity;
+	}
+
+	prtInternedTypes[prtNumInternedTypes] = type;
+	prtNumInternedTypes = prtNumInternedTypes + 1;
+	return type;
+}
+
+void PRT_CALL_CONV PrtClearInternedTypes(void)
+{
+	PrtFree(prtInternedTypes);
+	prtInternedTypes = NULL;
+	prtNumInternedTypes = 0;
+	prtInternedTypesCapacity = 0;
+}
+
 PRT_TYPE* PRT_CALL_CONV PrtCloneType(_In_ PRT_TYPE* type)
 {
 	PrtAssert(PrtIsValidType(type), "Invalid type expression");
@@ -4,6 +4,19 @@
 /** Maximum load factor before hashtable is resized. */
 #define PRT_MAXHASHLOAD 0.75
 
+/** Slot markers for the open-addressing hash indexes of maps and sets. */
+#define PRT_SLOT_EMPTY 0
+#define PRT_SLOT_DELETED 1
+
+/** Maps a hash code into the slot-hash range, reserving 0 and 1 for the slot markers. */
+#define PrtSlotHash(h) ((h) < 2 ? (h) + 2 : (h))
+
+/** Flags a slot number as belonging to the outgoing index of an incremental rehash. */
+#define PRT_SLOT_IN_OLD 0x80000000
+
+/** The number of outgoing-index slots each mutating operation migrates during an incremental rehash. */
+#define PRT_REHASH_STEP 8
+
 /** A 32-bit prime modulus for AC composition of hashcodes */
 #define PRT_HASH_AC_COMPOSEMOD 4294967291
 
@@ -21,6 +34,56 @@ const PRT_UINT32 PrtHashtableCapacities[] =
 /** The null machine id */
 const PRT_MACHINEID PrtNullMachineId = { {0, 0, 0, 0}, PRT_SPECIAL_EVENT_NULL };
 
+/* When PRT_USE_COW is defined, PrtCloneValue shares collection payloads
+ * (tuple/seq/set/map) between boxes instead of deep copying, and the copy is
+ * deferred until the first mutation (see PrtUnshareValue). The reference count
+ * updates must be atomic because a shared payload can be cloned on the sender's
+ * thread while the receiver frees its copy. */
+#if defined(PRT_USE_COW) && (defined(PRT_USE_GCC) || defined(PRT_USE_CLANG))
+#define PrtSharedRefIncr(c) ((void)__sync_add_and_fetch(&(c), 1))
+#define PrtSharedRefDecr(c) __sync_sub_and_fetch(&(c), 1)
+#else
+#define PrtSharedRefIncr(c) ((void)(++(c)))
+#define PrtSharedRefDecr(c) (--(c))
+#endif
+
+/* Scalar values (null/bool/int/float/event and machine-id boxes) are made and
+ * freed constantly -- a counter increment allocates a 16-byte box -- so each
+ * thread keeps a small cache of freed boxes and reuses them instead of round-
+ * tripping through the allocator. Free boxes are linked through the value
+ * union. Cached boxes are interchangeable with PrtMalloc'ed ones, so a box
+ * freed on another thread simply lands in that thread's cache. */
+#define PRT_SCALAR_CACHE_MAX 256
+
+static PRT_THREAD_LOCAL PRT_VALUE* prtScalarCacheHead = NULL;
+static PRT_THREAD_LOCAL PRT_UINT32 prtScalarCacheCount = 0;
+
+static PRT_VALUE* PRT_CALL_CONV PrtMkScalarValue(void)
+{
+	PRT_VALUE* box = prtScalarCacheHead;
+	if (box != NULL)
+	{
+		prtScalarCacheHead = (PRT_VALUE *)box->valueUnion.frgn;
+		prtScalarCacheCount--;
+		return box;
+	}
+
+	return (PRT_VALUE *)PrtMalloc(sizeof(PRT_VALUE));
+}
+
+static void PRT_CALL_CONV PrtFreeScalarValue(_Inout_ PRT_VALUE* value)
+{
+	if (prtScalarCacheCount >= PRT_SCALAR_CACHE_MAX)
+	{
+		PrtFree(value);
+		return;
+	}
+
+	value->valueUnion.frgn = (struct PRT_FOREIGNVALUE *)prtScalarCacheHead;
+	prtScalarCacheHead = value;
+	prtScalarCacheCount++;
+}
+
 // this function is not used.
 //static PRT_UINT32 PRT_CALL_CONV PrtGetHashCodeFieldName(_In_ PRT_STRING name)
 //{
@@ -81,19 +144,87 @@ static PRT_UINT32 PRT_CALL_CONV PrtGetHashCodePrtFloat(_In_ PRT_FLOAT value)
 	return PrtGetHashCodeUInt32((PRT_UINT32)value) ^ PrtGetHashCodeUInt32((PRT_UINT64)value >> 32);
 }
 
+/* Block hash backing the string and machine-id hash codes. P programs key
+ * maps by UUID-like strings, so the byte-at-a-time multiplicative loop this
+ * replaces was a measurable fraction of map time. The hash mixes 64-bit
+ * lanes with a wide multiply (wyhash-style); with SSE2 available, bulk input
+ * is first folded 16 bytes at a time before the scalar finish. On other
+ * 64-bit targets the wide multiply alone is already vector-strength. */
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+
+static PRT_UINT64 PrtHashBytesBlock(_In_ const PRT_UINT8* data, _In_ size_t len)
+{
+	__m128i acc = _mm_set_epi32((int)0x9E3779B1, (int)0x85EBCA77, (int)0xC2B2AE3D, (int)0x27D4EB2F);
+	const __m128i prime = _mm_set1_epi32((int)0x9E3779B1);
+	while (len >= 16)
+	{
+		const __m128i block = _mm_loadu_si128((const __m128i *)data);
+		acc = _mm_xor_si128(acc, block);
+		const __m128i even = _mm_mul_epu32(acc, prime);
+		const __m128i odd = _mm_mul_epu32(_mm_srli_epi64(acc, 32), prime);
+		acc = _mm_xor_si128(even, _mm_slli_epi64(odd, 29));
+		data += 16;
+		len -= 16;
+	}
+	PRT_UINT64 lanes[2];
+	_mm_storeu_si128((__m128i *)lanes, acc);
+	return lanes[0] ^ lanes[1] * 0x9E3779B97F4A7C15ULL;
+}
+#endif
+
+static PRT_UINT64 PrtHashMum(_In_ PRT_UINT64 a, _In_ PRT_UINT64 b)
+{
+#if defined(__SIZEOF_INT128__)
+	const unsigned __int128 product = (unsigned __int128)a * b;
+	return (PRT_UINT64)product ^ (PRT_UINT64)(product >> 64);
+#else
+	const PRT_UINT64 lo = (a & 0xFFFFFFFFULL) * (b & 0xFFFFFFFFULL);
+	const PRT_UINT64 hi = (a >> 32) * (b >> 32);
+	const PRT_UINT64 mid = (a >> 32) * (b & 0xFFFFFFFFULL) + (a & 0xFFFFFFFFULL) * (b >> 32);
+	return lo ^ (mid << 32) ^ (mid >> 32) ^ hi;
+#endif
+}
+
+static PRT_UINT64 PrtHashBytes(_In_ const void* bytes, _In_ size_t len)
+{
+	const PRT_UINT8* data = (const PRT_UINT8 *)bytes;
+	PRT_UINT64 hash = 0xA0761D6478BD642FULL ^ len;
+#if defined(__SSE2__)
+	if (len >= 16)
+	{
+		const size_t blockLen = len & ~(size_t)15;
+		hash = PrtHashMum(hash, PrtHashBytesBlock(data, blockLen));
+		data += blockLen;
+		len &= 15;
+	}
+#endif
+	while (len >= 8)
+	{
+		PRT_UINT64 lane;
+		memcpy(&lane, data, sizeof(lane));
+		hash = PrtHashMum(hash ^ lane, 0xE7037ED1A0B428DBULL);
+		data += 8;
+		len -= 8;
+	}
+	if (len > 0)
+	{
+		PRT_UINT64 lane = 0;
+		memcpy(&lane, data, len);
+		hash = PrtHashMum(hash ^ lane, 0xE7037ED1A0B428DBULL);
+	}
+	return PrtHashMum(hash, 0x8EBC6AF09C88C6E3ULL);
+}
+
 static PRT_UINT32 PRT_CALL_CONV PrtGetHashCodePrtString(_In_ PRT_STRING value)
 {
 	if (value == NULL)
 	{
 		return 0;
 	}
-	PRT_UINT32 code = 5381;
-	int c;
-	while (c = *value++) 
-	{
-		code = ((code << 5) + code) + c; /* code * 33 + c */	
-	}
-	return code;
+	const PRT_UINT64 hash = PrtHashBytes(value, strlen(value));
+	return (PRT_UINT32)hash ^ (PRT_UINT32)(hash >> 32);
 }
 
 static PRT_UINT32 PRT_CALL_CONV PrtGetHashCodeTwoUInt32(_In_ PRT_UINT32 value1, _In_ PRT_UINT32 value2)
@@ -124,76 +255,20 @@ static PRT_UINT32 PRT_CALL_CONV PrtGetHashCodeTwoUInt32(_In_ PRT_UINT32 value1,
 
 static PRT_UINT32 PRT_CALL_CONV PrtGetHashCodeMachineId(_In_ PRT_MACHINEID id)
 {
-	PRT_UINT32 i;
-	PRT_UINT32 code = 0;
-
-	PRT_UINT32 value = id.processId.data1;
-	for (i = 0; i < 4; ++i)
-	{
-		code += (value & 0x000000FF);
-		code += (code << 10);
-		code ^= (code >> 6);
-		value = (value >> 8);
-	}
-
-	value = id.processId.data2;
-	for (i = 0; i < 4; ++i)
-	{
-		code += (value & 0x000000FF);
-		code += (code << 10);
-		code ^= (code >> 6);
-		value = (value >> 8);
-	}
-
-	value = id.processId.data3;
-	for (i = 0; i < 4; ++i)
-	{
-		code += (value & 0x000000FF);
-		code += (code << 10);
-		code ^= (code >> 6);
-		value = (value >> 8);
-	}
-
-	//// Hash lower-order bits
-	value = (PRT_UINT32)id.processId.data4;
-	for (i = 0; i < 4; ++i)
-	{
-		code += (value & 0x000000FF);
-		code += (code << 10);
-		code ^= (code >> 6);
-		value = (value >> 8);
-	}
-
-	//// Hash higher-order bits
-	value = (PRT_UINT32)(id.processId.data4 >> 32);
-	for (i = 0; i < 4; ++i)
-	{
-		code += (value & 0x000000FF);
-		code += (code << 10);
-		code ^= (code >> 6);
-		value = (value >> 8);
-	}
-
-	value = id.machineId;
-	for (i = 0; i < 4; ++i)
-	{
-		code += (value & 0x000000FF);
-		code += (code << 10);
-		code ^= (code >> 6);
-		value = (value >> 8);
-	}
-
-	code += (code << 3);
-	code ^= (code >> 11);
-	code += (code << 15);
-	return code;
+	//// Pack the id fields densely so padding bytes never reach the hash.
+	PRT_UINT64 packed[3];
+	packed[0] = (PRT_UINT64)id.processId.data1 << 32 | (PRT_UINT64)id.processId.data2 << 16 | id.processId.data3;
+	packed[1] = id.processId.data4;
+	packed[2] = id.machineId;
+	const PRT_UINT64 hash = PrtHashBytes(packed, sizeof(packed));
+	return (PRT_UINT32)hash ^ (PRT_UINT32)(hash >> 32);
 }
 
 PRT_VALUE* PRT_CALL_CONV PrtMkBoolValue(_In_ PRT_BOOLEAN value)
 {
 	PrtAssert(value == PRT_TRUE || value == PRT_FALSE, "Expected a bool value");
 
-	PRT_VALUE* retVal = (PRT_VALUE*)PrtMalloc(sizeof(PRT_VALUE));
+	PRT_VALUE* retVal = PrtMkScalarValue();
 	retVal->discriminator = PRT_VALUE_KIND_BOOL;
 	retVal->valueUnion.bl = value;
 	return retVal;
@@ -201,7 +276,7 @@ PRT_VALUE* PRT_CALL_CONV PrtMkBoolValue(_In_ PRT_BOOLEAN value)
 
 PRT_VALUE* PRT_CALL_CONV PrtMkEventValue(_In_ PRT_UINT32 value)
 {
-	PRT_VALUE* retVal = (PRT_VALUE*)PrtMalloc(sizeof(PRT_VALUE));
+	PRT_VALUE* retVal = PrtMkScalarValue();
 	retVal->discriminator = PRT_VALUE_KIND_EVENT;
 	retVal->valueUnion.ev = value;
 	return retVal;
@@ -209,7 +284,7 @@ PRT_VALUE* PRT_CALL_CONV PrtMkEventValue(_In_ PRT_UINT32 value)
 
 PRT_VALUE* PRT_CALL_CONV PrtMkIntValue(_In_ PRT_INT value)
 {
-	PRT_VALUE* retVal = (PRT_VALUE*)PrtMalloc(sizeof(PRT_VALUE));
+	PRT_VALUE* retVal = PrtMkScalarValue();
 	retVal->discriminator = PRT_VALUE_KIND_INT;
 	retVal->valueUnion.nt = value;
 	return retVal;
@@ -217,7 +292,7 @@ PRT_VALUE* PRT_CALL_CONV PrtMkIntValue(_In_ PRT_INT value)
 
 PRT_VALUE* PRT_CALL_CONV PrtMkFloatValue(_In_ PRT_FLOAT value)
 {
-	PRT_VALUE* retVal = (PRT_VALUE*)PrtMalloc(sizeof(PRT_VALUE));
+	PRT_VALUE* retVal = PrtMkScalarValue();
 	retVal->discriminator = PRT_VALUE_KIND_FLOAT;
 	retVal->valueUnion.ft = value;
 	return retVal;
@@ -233,7 +308,7 @@ PRT_VALUE* PRT_CALL_CONV PrtMkStringValue(_In_ PRT_STRING value)
 
 PRT_VALUE* PRT_CALL_CONV PrtMkNullValue()
 {
-	PRT_VALUE* retVal = (PRT_VALUE*)PrtMalloc(sizeof(PRT_VALUE));
+	PRT_VALUE* retVal = PrtMkScalarValue();
 	retVal->discriminator = PRT_VALUE_KIND_NULL;
 	retVal->valueUnion.ev = PRT_SPECIAL_EVENT_NULL;
 	return retVal;
@@ -241,7 +316,7 @@ PRT_VALUE* PRT_CALL_CONV PrtMkNullValue()
 
 PRT_VALUE* PRT_CALL_CONV PrtMkMachineValue(_In_ PRT_MACHINEID value)
 {
-	PRT_VALUE* retVal = (PRT_VALUE*)PrtMalloc(sizeof(PRT_VALUE));
+	PRT_VALUE* retVal = PrtMkScalarValue();
 	PRT_MACHINEID* id = (PRT_MACHINEID *)PrtMalloc(sizeof(PRT_MACHINEID));
 	retVal->discriminator = PRT_VALUE_KIND_MID;
 	retVal->valueUnion.mid = id;
@@ -318,9 +393,16 @@ PRT_VALUE* PRT_CALL_CONV PrtMkDefaultValue(_In_ PRT_TYPE* type)
 		retVal->discriminator = PRT_VALUE_KIND_SET;
 		retVal->valueUnion.set = set;
 
+		set->refCount = 1;
 		set->size = 0;
 		set->capNum = 0;
-		set->buckets = (PRT_SETNODE **)PrtCalloc(PrtHashtableCapacities[0], sizeof(PRT_SETNODE *));
+		set->nDeleted = 0;
+		set->slotHashes = (PRT_UINT32 *)PrtCalloc(PrtHashtableCapacities[0], sizeof(PRT_UINT32));
+		set->slotNodes = (PRT_SETNODE **)PrtCalloc(PrtHashtableCapacities[0], sizeof(PRT_SETNODE *));
+		set->oldSlotHashes = NULL;
+		set->oldSlotNodes = NULL;
+		set->oldCapNum = 0;
+		set->rehashIndex = 0;
 		set->first = NULL;
 		set->last = NULL;
 		return retVal;
@@ -332,9 +414,16 @@ PRT_VALUE* PRT_CALL_CONV PrtMkDefaultValue(_In_ PRT_TYPE* type)
 		retVal->discriminator = PRT_VALUE_KIND_MAP;
 		retVal->valueUnion.map = map;
 
+		map->refCount = 1;
 		map->size = 0;
 		map->capNum = 0;
-		map->buckets = (PRT_MAPNODE **)PrtCalloc(PrtHashtableCapacities[0], sizeof(PRT_MAPNODE *));
+		map->nDeleted = 0;
+		map->slotHashes = (PRT_UINT32 *)PrtCalloc(PrtHashtableCapacities[0], sizeof(PRT_UINT32));
+		map->slotNodes = (PRT_MAPNODE **)PrtCalloc(PrtHashtableCapacities[0], sizeof(PRT_MAPNODE *));
+		map->oldSlotHashes = NULL;
+		map->oldSlotNodes = NULL;
+		map->oldCapNum = 0;
+		map->rehashIndex = 0;
 		map->first = NULL;
 		map->last = NULL;
 		return retVal;
@@ -342,13 +431,11 @@ PRT_VALUE* PRT_CALL_CONV PrtMkDefaultValue(_In_ PRT_TYPE* type)
 	case PRT_KIND_NMDTUP:
 	{
 		PRT_VALUE* retVal = (PRT_VALUE*)PrtMalloc(sizeof(PRT_VALUE));
-		PRT_TUPVALUE* tup = (PRT_TUPVALUE *)PrtMalloc(sizeof(PRT_TUPVALUE));
+		PRT_NMDTUPTYPE* ntype = type->typeUnion.nmTuple;
+		PRT_TUPVALUE* tup = PrtMkTuplePayload(ntype->arity);
 		retVal->discriminator = PRT_VALUE_KIND_TUPLE;
 		retVal->valueUnion.tuple = tup;
 		PRT_UINT32 i;
-		PRT_NMDTUPTYPE* ntype = type->typeUnion.nmTuple;
-		tup->size = ntype->arity;
-		tup->values = (PRT_VALUE **)PrtCalloc(ntype->arity, sizeof(PRT_VALUE*));
 		for (i = 0; i < ntype->arity; ++i)
 		{
 			tup->values[i] = PrtMkDefaultValue(ntype->fieldTypes[i]);
@@ -359,25 +446,18 @@ PRT_VALUE* PRT_CALL_CONV PrtMkDefaultValue(_In_ PRT_TYPE* type)
 	case PRT_KIND_SEQ:
 	{
 		PRT_VALUE* retVal = (PRT_VALUE*)PrtMalloc(sizeof(PRT_VALUE));
-		PRT_SEQVALUE* seq = (PRT_SEQVALUE *)PrtMalloc(sizeof(PRT_SEQVALUE));
 		retVal->discriminator = PRT_VALUE_KIND_SEQ;
-		retVal->valueUnion.seq = seq;
-
-		seq->size = 0;
-		seq->capacity = 0;
-		seq->values = NULL;
+		retVal->valueUnion.seq = PrtMkSeqPayload(0);
 		return retVal;
 	}
 	case PRT_KIND_TUPLE:
 	{
 		PRT_VALUE* retVal = (PRT_VALUE*)PrtMalloc(sizeof(PRT_VALUE));
-		PRT_TUPVALUE* tup = (PRT_TUPVALUE *)PrtMalloc(sizeof(PRT_TUPVALUE));
+		PRT_TUPTYPE* ttype = type->typeUnion.tuple;
+		PRT_TUPVALUE* tup = PrtMkTuplePayload(ttype->arity);
 		retVal->discriminator = PRT_VALUE_KIND_TUPLE;
 		retVal->valueUnion.tuple = tup;
 		PRT_UINT32 i;
-		PRT_TUPTYPE* ttype = type->typeUnion.tuple;
-		tup->size = ttype->arity;
-		tup->values = (PRT_VALUE **)PrtCalloc(ttype->arity, sizeof(PRT_VALUE*));
 		for (i = 0; i < ttype->arity; ++i)
 		{
 			tup->values[i] = PrtMkDefaultValue(ttype->fieldTypes[i]);
@@ -496,6 +576,275 @@ PRT_VALUE* PRT_CALL_CONV PrtStringConcat(_In_ PRT_VALUE* str1, _In_ PRT_VALUE* s
 	return PrtMkStringValue(ret);
 }
 
+PRT_TUPVALUE* PRT_CALL_CONV PrtMkTuplePayload(_In_ PRT_UINT32 arity)
+{
+	PRT_TUPVALUE* tup;
+	if (arity <= PRT_VALUE_INLINE_SLOTS)
+	{
+		//// Small tuples dominate event payloads; one allocation holds both the
+		//// header and the element slots, so building one costs a single
+		//// PrtCalloc and reading a field costs one pointer hop fewer.
+		tup = (PRT_TUPVALUE *)PrtCalloc(1, sizeof(PRT_TUPVALUE) + arity * sizeof(PRT_VALUE *));
+		tup->values = (PRT_VALUE **)(tup + 1);
+	}
+	else
+	{
+		tup = (PRT_TUPVALUE *)PrtMalloc(sizeof(PRT_TUPVALUE));
+		tup->values = (PRT_VALUE **)PrtCalloc(arity, sizeof(PRT_VALUE *));
+	}
+
+	tup->refCount = 1;
+	tup->size = arity;
+	return tup;
+}
+
+PRT_SEQVALUE* PRT_CALL_CONV PrtMkSeqPayload(_In_ PRT_UINT32 capacity)
+{
+	PRT_SEQVALUE* seq;
+	if (capacity <= PRT_VALUE_INLINE_SLOTS)
+	{
+		seq = (PRT_SEQVALUE *)PrtCalloc(1, sizeof(PRT_SEQVALUE) + PRT_VALUE_INLINE_SLOTS * sizeof(PRT_VALUE *));
+		seq->values = (PRT_VALUE **)(seq + 1);
+		seq->capacity = PRT_VALUE_INLINE_SLOTS;
+	}
+	else
+	{
+		seq = (PRT_SEQVALUE *)PrtMalloc(sizeof(PRT_SEQVALUE));
+		seq->values = (PRT_VALUE **)PrtCalloc(capacity, sizeof(PRT_VALUE *));
+		seq->capacity = capacity;
+	}
+
+	seq->refCount = 1;
+	seq->size = 0;
+	return seq;
+}
+
+/** Returns whether a tuple payload stores its elements inline after the header. */
+static PRT_BOOLEAN PrtTupleValuesInline(_In_ PRT_TUPVALUE* tVal)
+{
+	return tVal->values == (PRT_VALUE **)(tVal + 1) ? PRT_TRUE : PRT_FALSE;
+}
+
+/** Returns whether a sequence payload stores its elements inline after the header. */
+static PRT_BOOLEAN PrtSeqValuesInline(_In_ PRT_SEQVALUE* sVal)
+{
+	return sVal->values == (PRT_VALUE **)(sVal + 1) ? PRT_TRUE : PRT_FALSE;
+}
+
+/** Frees the contents of a tuple payload (but not any PRT_VALUE box pointing at it). */
+static void PRT_CALL_CONV PrtFreeTuplePayload(_Inout_ PRT_TUPVALUE* tVal)
+{
+	PRT_UINT32 i;
+	PRT_UINT32 arity = tVal->size;
+	for (i = 0; i < arity; ++i)
+	{
+		PrtFreeValue(tVal->values[i]);
+	}
+
+	if (!PrtTupleValuesInline(tVal))
+	{
+		PrtFree(tVal->values);
+	}
+	PrtFree(tVal);
+}
+
+/** Frees the contents of a sequence payload (but not any PRT_VALUE box pointing at it). */
+static void PRT_CALL_CONV PrtFreeSeqPayload(_Inout_ PRT_SEQVALUE* sVal)
+{
+	if (sVal->values != NULL)
+	{
+		PRT_UINT32 i;
+		for (i = 0; i < sVal->size; ++i)
+		{
+			PrtFreeValue(sVal->values[i]);
+		}
+
+		if (!PrtSeqValuesInline(sVal))
+		{
+			PrtFree(sVal->values);
+		}
+	}
+
+	PrtFree(sVal);
+}
+
+/** Frees the contents of a set payload (but not any PRT_VALUE box pointing at it). */
+static void PRT_CALL_CONV PrtFreeSetPayload(_Inout_ PRT_SETVALUE* uVal)
+{
+	PRT_SETNODE* next = uVal->first;
+	PRT_SETNODE* tmp;
+	while (next != NULL)
+	{
+		tmp = next->insertNext;
+		PrtFreeValue(next->item);
+		PrtFree(next);
+		next = tmp;
+	}
+
+	PrtFree(uVal->slotHashes);
+	PrtFree(uVal->slotNodes);
+	if (uVal->oldSlotHashes != NULL)
+	{
+		PrtFree(uVal->oldSlotHashes);
+		PrtFree(uVal->oldSlotNodes);
+	}
+	PrtFree(uVal);
+}
+
+/** Frees the contents of a map payload (but not any PRT_VALUE box pointing at it). */
+static void PRT_CALL_CONV PrtFreeMapPayload(_Inout_ PRT_MAPVALUE* mVal)
+{
+	PRT_MAPNODE* next = mVal->first;
+	PRT_MAPNODE* tmp;
+	while (next != NULL)
+	{
+		tmp = next->insertNext;
+		PrtFreeValue(next->key);
+		PrtFreeValue(next->value);
+		PrtFree(next);
+		next = tmp;
+	}
+
+	PrtFree(mVal->slotHashes);
+	PrtFree(mVal->slotNodes);
+	if (mVal->oldSlotHashes != NULL)
+	{
+		PrtFree(mVal->oldSlotHashes);
+		PrtFree(mVal->oldSlotNodes);
+	}
+	PrtFree(mVal);
+}
+
+/** Ensures the collection payload behind value is owned by this box alone.
+* With PRT_USE_COW, PrtCloneValue shares payloads between boxes, so every
+* operation that mutates a tuple/seq/set/map (or hands out an lvalue for
+* mutation) calls this first to perform the deferred copy. When the payload
+* is not shared this is a single comparison.
+*/
+static void PRT_CALL_CONV PrtUnshareValue(_Inout_ PRT_VALUE* value)
+{
+	switch (value->discriminator)
+	{
+	case PRT_VALUE_KIND_TUPLE:
+	{
+		PRT_TUPVALUE* tVal = value->valueUnion.tuple;
+		if (tVal->refCount == 1)
+		{
+			return;
+		}
+
+		PRT_UINT32 i;
+		PRT_TUPVALUE* cVal = PrtMkTuplePayload(tVal->size);
+		for (i = 0; i < tVal->size; ++i)
+		{
+			cVal->values[i] = PrtCloneValue(tVal->values[i]);
+		}
+
+		value->valueUnion.tuple = cVal;
+		if (PrtSharedRefDecr(tVal->refCount) == 0)
+		{
+			//// The other owners dropped their boxes while we copied.
+			PrtFreeTuplePayload(tVal);
+		}
+		break;
+	}
+	case PRT_VALUE_KIND_SEQ:
+	{
+		PRT_SEQVALUE* sVal = value->valueUnion.seq;
+		if (sVal->refCount == 1)
+		{
+			return;
+		}
+
+		PRT_SEQVALUE* cVal = PrtMkSeqPayload(sVal->size);
+		cVal->size = sVal->size;
+		for (PRT_UINT32 i = 0; i < sVal->size; ++i)
+		{
+			cVal->values[i] = PrtCloneValue(sVal->values[i]);
+		}
+
+		value->valueUnion.seq = cVal;
+		if (PrtSharedRefDecr(sVal->refCount) == 0)
+		{
+			PrtFreeSeqPayload(sVal);
+		}
+		break;
+	}
+	case PRT_VALUE_KIND_SET:
+	{
+		PRT_SETVALUE* uVal = value->valueUnion.set;
+		if (uVal->refCount == 1)
+		{
+			return;
+		}
+
+		PRT_SETVALUE* cVal = (PRT_SETVALUE *)PrtMalloc(sizeof(PRT_SETVALUE));
+		cVal->refCount = 1;
+		cVal->slotHashes = (PRT_UINT32 *)PrtCalloc(PrtHashtableCapacities[uVal->capNum], sizeof(PRT_UINT32));
+		cVal->slotNodes = (PRT_SETNODE **)PrtCalloc(PrtHashtableCapacities[uVal->capNum], sizeof(PRT_SETNODE *));
+		cVal->oldSlotHashes = NULL;
+		cVal->oldSlotNodes = NULL;
+		cVal->oldCapNum = 0;
+		cVal->rehashIndex = 0;
+		cVal->capNum = uVal->capNum;
+		cVal->nDeleted = 0;
+		cVal->size = 0;
+		cVal->first = NULL;
+		cVal->last = NULL;
+		value->valueUnion.set = cVal;
+		PRT_SETNODE* next = uVal->first;
+		while (next != NULL)
+		{
+			PrtSetAdd(value, next->item);
+			next = next->insertNext;
+		}
+
+		if (PrtSharedRefDecr(uVal->refCount) == 0)
+		{
+			PrtFreeSetPayload(uVal);
+		}
+		break;
+	}
+	case PRT_VALUE_KIND_MAP:
+	{
+		PRT_MAPVALUE* mVal = value->valueUnion.map;
+		if (mVal->refCount == 1)
+		{
+			return;
+		}
+
+		PRT_MAPVALUE* cVal = (PRT_MAPVALUE *)PrtMalloc(sizeof(PRT_MAPVALUE));
+		cVal->refCount = 1;
+		cVal->slotHashes = (PRT_UINT32 *)PrtCalloc(PrtHashtableCapacities[mVal->capNum], sizeof(PRT_UINT32));
+		cVal->slotNodes = (PRT_MAPNODE **)PrtCalloc(PrtHashtableCapacities[mVal->capNum], sizeof(PRT_MAPNODE *));
+		cVal->oldSlotHashes = NULL;
+		cVal->oldSlotNodes = NULL;
+		cVal->oldCapNum = 0;
+		cVal->rehashIndex = 0;
+		cVal->capNum = mVal->capNum;
+		cVal->nDeleted = 0;
+		cVal->size = 0;
+		cVal->first = NULL;
+		cVal->last = NULL;
+		value->valueUnion.map = cVal;
+		PRT_MAPNODE* next = mVal->first;
+		while (next != NULL)
+		{
+			PrtMapUpdate(value, next->key, next->value);
+			next = next->insertNext;
+		}
+
+		if (PrtSharedRefDecr(mVal->refCount) == 0)
+		{
+			PrtFreeMapPayload(mVal);
+		}
+		break;
+	}
+	default:
+		break;
+	}
+}
+
 
 void PRT_CALL_CONV PrtTupleSetEx(_Inout_ PRT_VALUE* tuple, _In_ PRT_UINT32 index, _In_ PRT_VALUE* value,
 	PRT_BOOLEAN cloneValue)
@@ -505,6 +854,7 @@ void PRT_CALL_CONV PrtTupleSetEx(_Inout_ PRT_VALUE* tuple, _In_ PRT_UINT32 index
 	PrtAssert(tuple->discriminator == PRT_VALUE_KIND_TUPLE, "Cannot perform tuple set on this value");
 	PrtAssert(index < tuple->valueUnion.tuple->size, "Invalid tuple index");
 
+	PrtUnshareValue(tuple);
 	PRT_VALUE* oldValue = tuple->valueUnion.tuple->values[index];
 	tuple->valueUnion.tuple->values[index] = cloneValue == PRT_TRUE ? PrtCloneValue(value) : value;
 	PrtFreeValue(oldValue);
@@ -530,6 +880,7 @@ PRT_VALUE** PRT_CALL_CONV PrtTupleGetLValue(_In_ PRT_VALUE* tuple, _In_ PRT_UINT
 	PrtAssert(tuple->discriminator == PRT_VALUE_KIND_TUPLE, "Cannot perform tuple get on this value");
 	PrtAssert(index < tuple->valueUnion.tuple->size, "Invalid tuple index");
 
+	PrtUnshareValue(tuple);
 	return &tuple->valueUnion.tuple->values[index];
 }
 
@@ -552,6 +903,7 @@ void PRT_CALL_CONV PrtSeqUpdateEx(_Inout_ PRT_VALUE* seq, _In_ PRT_VALUE* index,
 	PrtAssert(0 <= (PRT_UINT32)index->valueUnion.nt && (PRT_UINT32)index->valueUnion.nt <= seq->valueUnion.seq->size,
 		"Invalid index");
 
+	PrtUnshareValue(seq);
 	if ((PRT_UINT32)index->valueUnion.nt == seq->valueUnion.seq->size)
 	{
 		PrtSeqInsertEx(seq, index, value, cloneValue);
@@ -577,6 +929,7 @@ void PRT_CALL_CONV PrtSeqInsertExIntIndex(_Inout_ PRT_VALUE* seq, _In_ PRT_INT i
 	PrtAssert(seq->discriminator == PRT_VALUE_KIND_SEQ, "Invalid value");
 	PrtAssert(0 <= index && (PRT_UINT32)index <= seq->valueUnion.seq->size, "Invalid index");
 
+	PrtUnshareValue(seq);
 	PRT_VALUE* clone;
 	clone = cloneValue == PRT_TRUE ? PrtCloneValue(value) : value;
 	if (seq->valueUnion.seq->capacity == 0)
@@ -622,7 +975,10 @@ void PRT_CALL_CONV PrtSeqInsertExIntIndex(_Inout_ PRT_VALUE* seq, _In_ PRT_INT i
 		}
 
 		values[index] = clone;
-		PrtFree(seq->valueUnion.seq->values);
+		if (!PrtSeqValuesInline(seq->valueUnion.seq))
+		{
+			PrtFree(seq->valueUnion.seq->values);
+		}
 		seq->valueUnion.seq->values = values;
 	}
 
@@ -676,6 +1032,7 @@ void PRT_CALL_CONV PrtSeqRemove(_Inout_ PRT_VALUE* seq, _In_ PRT_VALUE* index)
 	PrtAssert(0 <= index->valueUnion.nt && (PRT_UINT32)index->valueUnion.nt < seq->valueUnion.seq->size, "Invalid index"
 	);
 
+	PrtUnshareValue(seq);
 	PRT_INT i;
 	PRT_VALUE** values = seq->valueUnion.seq->values;
 	PRT_UINT32 seqSize = seq->valueUnion.seq->size;
@@ -710,6 +1067,7 @@ PRT_VALUE** PRT_CALL_CONV PrtSeqGetLValue(_In_ PRT_VALUE* seq, _In_ PRT_VALUE* i
 {
 	PrtAssert(index->discriminator == PRT_VALUE_KIND_INT, "Invalid value");
 
+	PrtUnshareValue(seq);
 	return PrtSeqGetNCIntIndex(seq, index->valueUnion.nt);
 }
 
@@ -721,89 +1079,199 @@ PRT_UINT32 PRT_CALL_CONV PrtSeqSizeOf(_In_ PRT_VALUE* seq)
 	return seq->valueUnion.seq->size;
 }
 
-/** Expands the set and rehashes its items */
-static void PRT_CALL_CONV PrtSetExpand(_Inout_ PRT_VALUE* set)
+/** Probes the set's hash index for item. Returns the node holding item, or NULL
+* when item is absent; in the latter case *insertSlot is the slot a new node for
+* item should occupy (the first tombstone on the probe path, else the empty slot).
+* While an incremental rehash is running the outgoing index is consulted too; an
+* item found there has PRT_SLOT_IN_OLD set on its returned slot.
+*/
+static PRT_SETNODE* PRT_CALL_CONV PrtSetFindSlot(_In_ PRT_SETVALUE* setVal, _In_ PRT_VALUE* item,
+	_In_                                                     PRT_UINT32 itemHash,
+	_Out_                                                    PRT_UINT32* insertSlot)
 {
-	if (set->valueUnion.set->capNum + 1 >= sizeof(PrtHashtableCapacities) / sizeof(PRT_UINT32))
+	const PRT_UINT32 cap = PrtHashtableCapacities[setVal->capNum];
+	PRT_UINT32 slot = itemHash % cap;
+	PRT_UINT32 freeSlot = cap;
+	for (;;)
 	{
-		//// Set has reached maximum capacity.
-		return;
+		const PRT_UINT32 slotHash = setVal->slotHashes[slot];
+		if (slotHash == PRT_SLOT_EMPTY)
+		{
+			*insertSlot = freeSlot == cap ? slot : freeSlot;
+			break;
+		}
+
+		if (slotHash == PRT_SLOT_DELETED)
+		{
+			if (freeSlot == cap)
+			{
+				freeSlot = slot;
+			}
+		}
+		else if (slotHash == itemHash && PrtIsEqualValue(setVal->slotNodes[slot]->item, item))
+		{
+			*insertSlot = slot;
+			return setVal->slotNodes[slot];
+		}
+
+		slot = slot + 1 == cap ? 0 : slot + 1;
 	}
 
-	set->valueUnion.set->capNum = set->valueUnion.set->capNum + 1;
-	//// Erase all bucket-next pointers
-	PRT_SETNODE* next = set->valueUnion.set->first;
-	while (next != NULL)
+	if (setVal->oldSlotHashes == NULL)
 	{
-		next->bucketNext = NULL;
-		next = next->insertNext;
+		return NULL;
+	}
+
+	//// Not in the new index; the item may not have been migrated yet.
+	const PRT_UINT32 oldCap = PrtHashtableCapacities[setVal->oldCapNum];
+	slot = itemHash % oldCap;
+	for (;;)
+	{
+		const PRT_UINT32 slotHash = setVal->oldSlotHashes[slot];
+		if (slotHash == PRT_SLOT_EMPTY)
+		{
+			return NULL;
+		}
+
+		if (slotHash == itemHash && PrtIsEqualValue(setVal->oldSlotNodes[slot]->item, item))
+		{
+			*insertSlot = slot | PRT_SLOT_IN_OLD;
+			return setVal->oldSlotNodes[slot];
+		}
+
+		slot = slot + 1 == oldCap ? 0 : slot + 1;
 	}
+}
 
-	//// Resize buckets
-	PrtFree(set->valueUnion.set->buckets);
-	set->valueUnion.set->buckets = (PRT_SETNODE **)PrtCalloc(PrtHashtableCapacities[set->valueUnion.set->capNum],
-		sizeof(PRT_SETNODE *));
+/** Inserts a node into the set's hash index, reusing a tombstone when the probe path has one. */
+static void PRT_CALL_CONV PrtSetReindexNode(_Inout_ PRT_SETVALUE* setVal, _In_ PRT_SETNODE* node,
+	_In_                                                    PRT_UINT32 itemHash)
+{
+	const PRT_UINT32 cap = PrtHashtableCapacities[setVal->capNum];
+	PRT_UINT32 slot = itemHash % cap;
+	while (setVal->slotHashes[slot] != PRT_SLOT_EMPTY && setVal->slotHashes[slot] != PRT_SLOT_DELETED)
+	{
+		slot = slot + 1 == cap ? 0 : slot + 1;
+	}
 
-	//// Do the rehash, updating the bucketNext pointers
-	PRT_UINT32 bucketNum;
-	PRT_SETNODE* bucket;
-	next = set->valueUnion.set->first;
-	while (next != NULL)
+	if (setVal->slotHashes[slot] == PRT_SLOT_DELETED)
 	{
-		bucketNum = PrtGetHashCodeValue(next->item) % PrtHashtableCapacities[set->valueUnion.set->capNum];
-		bucket = set->valueUnion.set->buckets[bucketNum];
-		if (bucket != NULL)
+		setVal->nDeleted = setVal->nDeleted - 1;
+	}
+
+	setVal->slotHashes[slot] = itemHash;
+	setVal->slotNodes[slot] = node;
+}
+
+/** Migrates up to PRT_REHASH_STEP slots of the outgoing index into the current
+* one, retiring the outgoing index once its last slot has moved. Called from
+* mutating operations only, so a shared (copy-on-write) payload is never
+* migrated behind a reader's back.
+*/
+static void PRT_CALL_CONV PrtSetRehashStep(_Inout_ PRT_SETVALUE* setVal)
+{
+	if (setVal->oldSlotHashes == NULL)
+	{
+		return;
+	}
+
+	const PRT_UINT32 oldCap = PrtHashtableCapacities[setVal->oldCapNum];
+	PRT_UINT32 examined = 0;
+	while (setVal->rehashIndex < oldCap && examined < PRT_REHASH_STEP)
+	{
+		const PRT_UINT32 slotHash = setVal->oldSlotHashes[setVal->rehashIndex];
+		if (slotHash != PRT_SLOT_EMPTY && slotHash != PRT_SLOT_DELETED)
 		{
-			next->bucketNext = bucket;
+			PrtSetReindexNode(setVal, setVal->oldSlotNodes[setVal->rehashIndex], slotHash);
+			//// Retire the old slot so the node is indexed exactly once; a
+			//// lookup that misses in the current index must not resurrect it.
+			setVal->oldSlotHashes[setVal->rehashIndex] = PRT_SLOT_DELETED;
+			setVal->oldSlotNodes[setVal->rehashIndex] = NULL;
 		}
 
-		set->valueUnion.set->buckets[bucketNum] = next;
-		next = next->insertNext;
+		setVal->rehashIndex = setVal->rehashIndex + 1;
+		examined = examined + 1;
+	}
+
+	if (setVal->rehashIndex == oldCap)
+	{
+		PrtFree(setVal->oldSlotHashes);
+		PrtFree(setVal->oldSlotNodes);
+		setVal->oldSlotHashes = NULL;
+		setVal->oldSlotNodes = NULL;
+	}
+}
+
+/** Runs the incremental rehash to completion. */
+static void PRT_CALL_CONV PrtSetFinishRehash(_Inout_ PRT_SETVALUE* setVal)
+{
+	while (setVal->oldSlotHashes != NULL)
+	{
+		PrtSetRehashStep(setVal);
 	}
 }
 
+/** Expands the set when possible and begins an incremental rehash into the new
+* index: the old slot arrays are kept and PrtSetRehashStep migrates a bounded
+* number of slots per mutating operation, so no single operation pays for
+* rehashing the whole table.
+*/
+static void PRT_CALL_CONV PrtSetExpand(_Inout_ PRT_VALUE* set)
+{
+	PRT_SETVALUE* setVal = set->valueUnion.set;
+
+	//// A rehash that is still running is finished first rather than keeping
+	//// three generations of slot arrays alive.
+	PrtSetFinishRehash(setVal);
+
+	setVal->oldSlotHashes = setVal->slotHashes;
+	setVal->oldSlotNodes = setVal->slotNodes;
+	setVal->oldCapNum = setVal->capNum;
+	setVal->rehashIndex = 0;
+
+	if (setVal->capNum + 1 < sizeof(PrtHashtableCapacities) / sizeof(PRT_UINT32))
+	{
+		setVal->capNum = setVal->capNum + 1;
+	}
+
+	const PRT_UINT32 cap = PrtHashtableCapacities[setVal->capNum];
+	setVal->slotHashes = (PRT_UINT32 *)PrtCalloc(cap, sizeof(PRT_UINT32));
+	setVal->slotNodes = (PRT_SETNODE **)PrtCalloc(cap, sizeof(PRT_SETNODE *));
+	setVal->nDeleted = 0;
+}
+
 PRT_VALUE** PrtSetAddHelper(_Inout_ PRT_VALUE* set, _In_ PRT_VALUE* item, _In_ PRT_BOOLEAN cloneItem)
 {
 	PrtAssert(PrtIsValidValue(set), "Invalid value expression.");
 	PrtAssert(PrtIsValidValue(item), "Invalid value expression.");
 	PrtAssert(set->discriminator == PRT_VALUE_KIND_SET, "Invalid value");
 
-	PRT_SETNODE* node;
-
-	const PRT_UINT32 bucket_num = PrtGetHashCodeValue(item) % PrtHashtableCapacities[set->valueUnion.set->capNum];
-	PRT_SETNODE* bucket = set->valueUnion.set->buckets[bucket_num];
-	if (bucket == NULL)
+	PrtUnshareValue(set);
+	PrtSetRehashStep(set->valueUnion.set);
+	const PRT_UINT32 itemHash = PrtSlotHash(PrtGetHashCodeValue(item));
+	PRT_UINT32 slot;
+	PRT_SETNODE* node = PrtSetFindSlot(set->valueUnion.set, item, itemHash, &slot);
+	if (node != NULL)
 	{
-		node = (PRT_SETNODE *)PrtMalloc(sizeof(PRT_SETNODE));
-		node->item = cloneItem == PRT_TRUE ? PrtCloneValue(item) : item;
-		node->bucketNext = NULL;
-		node->insertNext = NULL;
-		set->valueUnion.set->buckets[bucket_num] = node;
-	}
-	else
-	{
-		PRT_SETNODE* next = bucket;
-		while (next != NULL)
+		//// Then need to free the unused item.
+		if (cloneItem != PRT_TRUE)
 		{
-			if (PrtIsEqualValue(next->item, item))
-			{
-				//// Then need to free the unused item.
-				if (cloneItem != PRT_TRUE)
-				{
-					PrtFreeValue(item);
-				}
-				return &next->item;
-			}
-			next = next->bucketNext;
+			PrtFreeValue(item);
 		}
+		return &node->item;
+	}
 
-		node = (PRT_SETNODE *)PrtMalloc(sizeof(PRT_SETNODE));
-		node->item = cloneItem == PRT_TRUE ? PrtCloneValue(item) : item;
-		node->bucketNext = bucket;
-		node->insertNext = NULL;
-		set->valueUnion.set->buckets[bucket_num] = node;
+	node = (PRT_SETNODE *)PrtMalloc(sizeof(PRT_SETNODE));
+	node->item = cloneItem == PRT_TRUE ? PrtCloneValue(item) : item;
+	node->insertNext = NULL;
+	if (set->valueUnion.set->slotHashes[slot] == PRT_SLOT_DELETED)
+	{
+		set->valueUnion.set->nDeleted = set->valueUnion.set->nDeleted - 1;
 	}
 
+	set->valueUnion.set->slotHashes[slot] = itemHash;
+	set->valueUnion.set->slotNodes[slot] = node;
+
 	if (set->valueUnion.set->last == NULL)
 	{
 		set->valueUnion.set->first = node;
@@ -819,8 +1287,8 @@ PRT_VALUE** PrtSetAddHelper(_Inout_ PRT_VALUE* set, _In_ PRT_VALUE* item, _In_ P
 
 	set->valueUnion.set->size = set->valueUnion.set->size + 1;
 
-	if (((double)set->valueUnion.set->size) / ((double)PrtHashtableCapacities[set->valueUnion.set->capNum]) > ((double)
-		PRT_MAXHASHLOAD))
+	if (((double)(set->valueUnion.set->size + set->valueUnion.set->nDeleted)) / ((double)PrtHashtableCapacities[set->
+		valueUnion.set->capNum]) > ((double)PRT_MAXHASHLOAD))
 	{
 		PrtSetExpand(set);
 	}
@@ -846,61 +1314,54 @@ void PRT_CALL_CONV PrtSetRemove(_Inout_ PRT_VALUE* set, _In_ PRT_VALUE* item)
 	PrtAssert(PrtIsValidValue(item), "Invalid value expression.");
 	PrtAssert(set->discriminator == PRT_VALUE_KIND_SET, "Invalid value");
 
-	PRT_UINT32 bucketNum;
-	PRT_SETNODE* bucket;
-	bucketNum = PrtGetHashCodeValue(item) % PrtHashtableCapacities[set->valueUnion.set->capNum];
-	bucket = set->valueUnion.set->buckets[bucketNum];
-	if (bucket == NULL)
+	PrtUnshareValue(set);
+	PrtSetRehashStep(set->valueUnion.set);
+	PRT_UINT32 slot;
+	PRT_SETNODE* next = PrtSetFindSlot(set->valueUnion.set, item, PrtSlotHash(PrtGetHashCodeValue(item)), &slot);
+	if (next == NULL)
 	{
 		return;
 	}
 
-	PRT_SETNODE* next = bucket;
-	PRT_SETNODE* prev = NULL;
-	while (next != NULL)
+	PrtFreeValue(next->item);
+	//// Leave a tombstone so probe chains running through this slot stay intact
+	if ((slot & PRT_SLOT_IN_OLD) != 0)
 	{
-		if (PrtIsEqualValue(next->item, item))
-		{
-			PrtFreeValue(next->item);
-			if (next == bucket)
-			{
-				set->valueUnion.set->buckets[bucketNum] = next->bucketNext;
-			}
-			else
-			{
-				prev->bucketNext = next->bucketNext;
-			}
-
-			if (next->insertPrev == NULL)
-			{
-				//// Then this was the first item
-				set->valueUnion.set->first = next->insertNext;
-			}
-			else
-			{
-				//// Otherwise the next of the previous item is the next of this item
-				next->insertPrev->insertNext = next->insertNext;
-			}
-
-			if (next->insertNext == NULL)
-			{
-				//// Then this was the last item
-				set->valueUnion.set->last = next->insertPrev;
-			}
-			else
-			{
-				//// Otherwise the previous of the next item is the previous of this item
-				next->insertNext->insertPrev = next->insertPrev;
-			}
+		//// The item had not been migrated yet; tombstone the outgoing index.
+		set->valueUnion.set->oldSlotHashes[slot & ~PRT_SLOT_IN_OLD] = PRT_SLOT_DELETED;
+		set->valueUnion.set->oldSlotNodes[slot & ~PRT_SLOT_IN_OLD] = NULL;
+	}
+	else
+	{
+		set->valueUnion.set->slotHashes[slot] = PRT_SLOT_DELETED;
+		set->valueUnion.set->slotNodes[slot] = NULL;
+		set->valueUnion.set->nDeleted = set->valueUnion.set->nDeleted + 1;
+	}
 
-			PrtFree(next);
-			set->valueUnion.set->size = set->valueUnion.set->size - 1;
-			return;
-		}
+	if (next->insertPrev == NULL)
+	{
+		//// Then this was the first item
+		set->valueUnion.set->first = next->insertNext;
+	}
+	else
+	{
+		//// Otherwise the next of the previous item is the next of this item
+		next->insertPrev->insertNext = next->insertNext;
+	}
 
-		prev = next;
-		next = next->bucketNext;
+	if (next->insertNext == NULL)
+	{
+		//// Then this was the last item
+		set->valueUnion.set->last = next->insertPrev;
+	}
+	else
+	{
+		//// Otherwise the previous of the next item is the previous of this item
+		next->insertNext->insertPrev = next->insertPrev;
 	}
+
+	PrtFree(next);
+	set->valueUnion.set->size = set->valueUnion.set->size - 1;
 }
 
 PRT_BOOLEAN PRT_CALL_CONV PrtSetExists(_In_ PRT_VALUE* set, _In_ PRT_VALUE* item)
@@ -909,27 +1370,9 @@ PRT_BOOLEAN PRT_CALL_CONV PrtSetExists(_In_ PRT_VALUE* set, _In_ PRT_VALUE* item
 	PrtAssert(PrtIsValidValue(item), "Invalid value expression.");
 	PrtAssert((set->discriminator == PRT_VALUE_KIND_SET), "Invalid value");
 
-	PRT_UINT32 bucketNum;
-	PRT_SETNODE* bucket;
-	bucketNum = PrtGetHashCodeValue(item) % PrtHashtableCapacities[set->valueUnion.set->capNum];
-	bucket = set->valueUnion.set->buckets[bucketNum];
-	if (bucket == NULL)
-	{
-		return PRT_FALSE;
-	}
-
-	PRT_SETNODE* next = bucket;
-	while (next != NULL)
-	{
-		if (PrtIsEqualValue(next->item, item))
-		{
-			return PRT_TRUE;
-		}
-
-		next = next->bucketNext;
-	}
-
-	return PRT_FALSE;
+	PRT_UINT32 slot;
+	PRT_SETNODE* node = PrtSetFindSlot(set->valueUnion.set, item, PrtSlotHash(PrtGetHashCodeValue(item)), &slot);
+	return node == NULL ? PRT_FALSE : PRT_TRUE;
 }
 
 
@@ -950,47 +1393,165 @@ PRT_UINT32 PRT_CALL_CONV PrtSetCapacity(_In_ PRT_VALUE* set)
 }
 
 
-/** Expands the map and rehashes its key-value pairs */
-static void PRT_CALL_CONV PrtMapExpand(_Inout_ PRT_VALUE* map)
+/** Probes the map's hash index for key. Returns the node holding key, or NULL
+* when key is absent; in the latter case *insertSlot is the slot a new node for
+* key should occupy (the first tombstone on the probe path, else the empty slot).
+*/
+static PRT_MAPNODE* PRT_CALL_CONV PrtMapFindSlot(_In_ PRT_MAPVALUE* mapVal, _In_ PRT_VALUE* key,
+	_In_                                                     PRT_UINT32 keyHash,
+	_Out_                                                    PRT_UINT32* insertSlot)
 {
-	if (map->valueUnion.map->capNum + 1 >= sizeof(PrtHashtableCapacities) / sizeof(PRT_UINT32))
+	const PRT_UINT32 cap = PrtHashtableCapacities[mapVal->capNum];
+	PRT_UINT32 slot = keyHash % cap;
+	PRT_UINT32 freeSlot = cap;
+	for (;;)
 	{
-		//// Map has reached maximum capacity.
-		return;
+		const PRT_UINT32 slotHash = mapVal->slotHashes[slot];
+		if (slotHash == PRT_SLOT_EMPTY)
+		{
+			*insertSlot = freeSlot == cap ? slot : freeSlot;
+			break;
+		}
+
+		if (slotHash == PRT_SLOT_DELETED)
+		{
+			if (freeSlot == cap)
+			{
+				freeSlot = slot;
+			}
+		}
+		else if (slotHash == keyHash && PrtIsEqualValue(mapVal->slotNodes[slot]->key, key))
+		{
+			*insertSlot = slot;
+			return mapVal->slotNodes[slot];
+		}
+
+		slot = slot + 1 == cap ? 0 : slot + 1;
 	}
 
-	map->valueUnion.map->capNum = map->valueUnion.map->capNum + 1;
-	//// Erase all bucket-next pointers
-	PRT_MAPNODE* next = map->valueUnion.map->first;
-	while (next != NULL)
+	if (mapVal->oldSlotHashes == NULL)
 	{
-		next->bucketNext = NULL;
-		next = next->insertNext;
+		return NULL;
 	}
 
-	//// Resize buckets
-	PrtFree(map->valueUnion.map->buckets);
-	map->valueUnion.map->buckets = (PRT_MAPNODE **)PrtCalloc(PrtHashtableCapacities[map->valueUnion.map->capNum],
-		sizeof(PRT_MAPNODE *));
+	//// Not in the new index; the key may not have been migrated yet.
+	const PRT_UINT32 oldCap = PrtHashtableCapacities[mapVal->oldCapNum];
+	slot = keyHash % oldCap;
+	for (;;)
+	{
+		const PRT_UINT32 slotHash = mapVal->oldSlotHashes[slot];
+		if (slotHash == PRT_SLOT_EMPTY)
+		{
+			return NULL;
+		}
 
-	//// Do the rehash, updating the bucketNext pointers
-	PRT_UINT32 bucketNum;
-	PRT_MAPNODE* bucket;
-	next = map->valueUnion.map->first;
-	while (next != NULL)
+		if (slotHash == keyHash && PrtIsEqualValue(mapVal->oldSlotNodes[slot]->key, key))
+		{
+			*insertSlot = slot | PRT_SLOT_IN_OLD;
+			return mapVal->oldSlotNodes[slot];
+		}
+
+		slot = slot + 1 == oldCap ? 0 : slot + 1;
+	}
+}
+
+/** Inserts a node into the map's hash index, reusing a tombstone when the probe path has one. */
+static void PRT_CALL_CONV PrtMapReindexNode(_Inout_ PRT_MAPVALUE* mapVal, _In_ PRT_MAPNODE* node,
+	_In_                                                    PRT_UINT32 keyHash)
+{
+	const PRT_UINT32 cap = PrtHashtableCapacities[mapVal->capNum];
+	PRT_UINT32 slot = keyHash % cap;
+	while (mapVal->slotHashes[slot] != PRT_SLOT_EMPTY && mapVal->slotHashes[slot] != PRT_SLOT_DELETED)
+	{
+		slot = slot + 1 == cap ? 0 : slot + 1;
+	}
+
+	if (mapVal->slotHashes[slot] == PRT_SLOT_DELETED)
+	{
+		mapVal->nDeleted = mapVal->nDeleted - 1;
+	}
+
+	mapVal->slotHashes[slot] = keyHash;
+	mapVal->slotNodes[slot] = node;
+}
+
+/** Migrates up to PRT_REHASH_STEP slots of the outgoing index into the current
+* one, retiring the outgoing index once its last slot has moved. Called from
+* mutating operations only, so a shared (copy-on-write) payload is never
+* migrated behind a reader's back.
+*/
+static void PRT_CALL_CONV PrtMapRehashStep(_Inout_ PRT_MAPVALUE* mapVal)
+{
+	if (mapVal->oldSlotHashes == NULL)
+	{
+		return;
+	}
+
+	const PRT_UINT32 oldCap = PrtHashtableCapacities[mapVal->oldCapNum];
+	PRT_UINT32 examined = 0;
+	while (mapVal->rehashIndex < oldCap && examined < PRT_REHASH_STEP)
 	{
-		bucketNum = PrtGetHashCodeValue(next->key) % PrtHashtableCapacities[map->valueUnion.map->capNum];
-		bucket = map->valueUnion.map->buckets[bucketNum];
-		if (bucket != NULL)
+		const PRT_UINT32 slotHash = mapVal->oldSlotHashes[mapVal->rehashIndex];
+		if (slotHash != PRT_SLOT_EMPTY && slotHash != PRT_SLOT_DELETED)
 		{
-			next->bucketNext = bucket;
+			PrtMapReindexNode(mapVal, mapVal->oldSlotNodes[mapVal->rehashIndex], slotHash);
+			//// Retire the old slot so the node is indexed exactly once; a
+			//// lookup that misses in the current index must not resurrect it.
+			mapVal->oldSlotHashes[mapVal->rehashIndex] = PRT_SLOT_DELETED;
+			mapVal->oldSlotNodes[mapVal->rehashIndex] = NULL;
 		}
 
-		map->valueUnion.map->buckets[bucketNum] = next;
-		next = next->insertNext;
+		mapVal->rehashIndex = mapVal->rehashIndex + 1;
+		examined = examined + 1;
+	}
+
+	if (mapVal->rehashIndex == oldCap)
+	{
+		PrtFree(mapVal->oldSlotHashes);
+		PrtFree(mapVal->oldSlotNodes);
+		mapVal->oldSlotHashes = NULL;
+		mapVal->oldSlotNodes = NULL;
+	}
+}
+
+/** Runs the incremental rehash to completion. */
+static void PRT_CALL_CONV PrtMapFinishRehash(_Inout_ PRT_MAPVALUE* mapVal)
+{
+	while (mapVal->oldSlotHashes != NULL)
+	{
+		PrtMapRehashStep(mapVal);
 	}
 }
 
+/** Expands the map when possible and begins an incremental rehash into the new
+* index: the old slot arrays are kept and PrtMapRehashStep migrates a bounded
+* number of slots per mutating operation, so no single operation pays for
+* rehashing the whole table.
+*/
+static void PRT_CALL_CONV PrtMapExpand(_Inout_ PRT_VALUE* map)
+{
+	PRT_MAPVALUE* mapVal = map->valueUnion.map;
+
+	//// A rehash that is still running is finished first rather than keeping
+	//// three generations of slot arrays alive.
+	PrtMapFinishRehash(mapVal);
+
+	mapVal->oldSlotHashes = mapVal->slotHashes;
+	mapVal->oldSlotNodes = mapVal->slotNodes;
+	mapVal->oldCapNum = mapVal->capNum;
+	mapVal->rehashIndex = 0;
+
+	if (mapVal->capNum + 1 < sizeof(PrtHashtableCapacities) / sizeof(PRT_UINT32))
+	{
+		mapVal->capNum = mapVal->capNum + 1;
+	}
+
+	const PRT_UINT32 cap = PrtHashtableCapacities[mapVal->capNum];
+	mapVal->slotHashes = (PRT_UINT32 *)PrtCalloc(cap, sizeof(PRT_UINT32));
+	mapVal->slotNodes = (PRT_MAPNODE **)PrtCalloc(cap, sizeof(PRT_MAPNODE *));
+	mapVal->nDeleted = 0;
+}
+
 PRT_VALUE** PrtMapUpdateHelper(_Inout_ PRT_VALUE* map, _In_ PRT_VALUE* key, _In_ PRT_BOOLEAN cloneKey,
 	_In_                                       PRT_VALUE* value,
 	_In_                                       PRT_BOOLEAN cloneValue)
@@ -1000,51 +1561,38 @@ PRT_VALUE** PrtMapUpdateHelper(_Inout_ PRT_VALUE* map, _In_ PRT_VALUE* key, _In_
 	PrtAssert(PrtIsValidValue(value), "Invalid value expression.");
 	PrtAssert(map->discriminator == PRT_VALUE_KIND_MAP, "Invalid value");
 
-	PRT_MAPNODE* node;
-
-	const PRT_UINT32 bucket_num = PrtGetHashCodeValue(key) % PrtHashtableCapacities[map->valueUnion.map->capNum];
-	PRT_MAPNODE* bucket = map->valueUnion.map->buckets[bucket_num];
-	if (bucket == NULL)
-	{
-		node = (PRT_MAPNODE *)PrtMalloc(sizeof(PRT_MAPNODE));
-		node->key = cloneKey == PRT_TRUE ? PrtCloneValue(key) : key;
-		node->value = cloneValue == PRT_TRUE ? PrtCloneValue(value) : value;
-		node->bucketNext = NULL;
-		node->insertNext = NULL;
-		map->valueUnion.map->buckets[bucket_num] = node;
-	}
-	else
+	PrtUnshareValue(map);
+	PrtMapRehashStep(map->valueUnion.map);
+	const PRT_UINT32 keyHash = PrtSlotHash(PrtGetHashCodeValue(key));
+	PRT_UINT32 slot;
+	PRT_MAPNODE* node = PrtMapFindSlot(map->valueUnion.map, key, keyHash, &slot);
+	if (node != NULL)
 	{
-		PRT_VALUE* valueClone = cloneValue == PRT_TRUE ? PrtCloneValue(value) : value;
-		PRT_MAPNODE* next = bucket;
-		while (next != NULL)
+		//// Then need to free the unused key.
+		if (cloneKey != PRT_TRUE)
 		{
-			if (PrtIsEqualValue(next->key, key))
-			{
-				//// Then need to free the unused key.
-				if (cloneKey != PRT_TRUE)
-				{
-					PrtFreeValue(key);
-				}
-
-				PRT_VALUE* oldValue = next->value;
-				next->value = valueClone;
-				PrtFreeValue(oldValue);
+			PrtFreeValue(key);
+		}
 
-				return &next->value;
-			}
+		PRT_VALUE* oldValue = node->value;
+		node->value = cloneValue == PRT_TRUE ? PrtCloneValue(value) : value;
+		PrtFreeValue(oldValue);
 
-			next = next->bucketNext;
-		}
+		return &node->value;
+	}
 
-		node = (PRT_MAPNODE *)PrtMalloc(sizeof(PRT_MAPNODE));
-		node->key = cloneKey == PRT_TRUE ? PrtCloneValue(key) : key;
-		node->value = valueClone;
-		node->bucketNext = bucket;
-		node->insertNext = NULL;
-		map->valueUnion.map->buckets[bucket_num] = node;
+	node = (PRT_MAPNODE *)PrtMalloc(sizeof(PRT_MAPNODE));
+	node->key = cloneKey == PRT_TRUE ? PrtCloneValue(key) : key;
+	node->value = cloneValue == PRT_TRUE ? PrtCloneValue(value) : value;
+	node->insertNext = NULL;
+	if (map->valueUnion.map->slotHashes[slot] == PRT_SLOT_DELETED)
+	{
+		map->valueUnion.map->nDeleted = map->valueUnion.map->nDeleted - 1;
 	}
 
+	map->valueUnion.map->slotHashes[slot] = keyHash;
+	map->valueUnion.map->slotNodes[slot] = node;
+
 	if (map->valueUnion.map->last == NULL)
 	{
 		map->valueUnion.map->first = node;
@@ -1060,8 +1608,8 @@ PRT_VALUE** PrtMapUpdateHelper(_Inout_ PRT_VALUE* map, _In_ PRT_VALUE* key, _In_
 
 	map->valueUnion.map->size = map->valueUnion.map->size + 1;
 
-	if (((double)map->valueUnion.map->size) / ((double)PrtHashtableCapacities[map->valueUnion.map->capNum]) > ((double)
-		PRT_MAXHASHLOAD))
+	if (((double)(map->valueUnion.map->size + map->valueUnion.map->nDeleted)) / ((double)PrtHashtableCapacities[map->
+		valueUnion.map->capNum]) > ((double)PRT_MAXHASHLOAD))
 	{
 		PrtMapExpand(map);
 	}
@@ -1087,62 +1635,55 @@ void PRT_CALL_CONV PrtMapRemove(_Inout_ PRT_VALUE* map, _In_ PRT_VALUE* key)
 	PrtAssert(PrtIsValidValue(key), "Invalid value expression.");
 	PrtAssert(map->discriminator == PRT_VALUE_KIND_MAP, "Invalid value");
 
-	PRT_UINT32 bucketNum;
-	PRT_MAPNODE* bucket;
-	bucketNum = PrtGetHashCodeValue(key) % PrtHashtableCapacities[map->valueUnion.map->capNum];
-	bucket = map->valueUnion.map->buckets[bucketNum];
-	if (bucket == NULL)
+	PrtUnshareValue(map);
+	PrtMapRehashStep(map->valueUnion.map);
+	PRT_UINT32 slot;
+	PRT_MAPNODE* next = PrtMapFindSlot(map->valueUnion.map, key, PrtSlotHash(PrtGetHashCodeValue(key)), &slot);
+	if (next == NULL)
 	{
 		return;
 	}
 
-	PRT_MAPNODE* next = bucket;
-	PRT_MAPNODE* prev = NULL;
-	while (next != NULL)
+	PrtFreeValue(next->key);
+	PrtFreeValue(next->value);
+	//// Leave a tombstone so probe chains running through this slot stay intact
+	if ((slot & PRT_SLOT_IN_OLD) != 0)
 	{
-		if (PrtIsEqualValue(next->key, key))
-		{
-			PrtFreeValue(next->key);
-			PrtFreeValue(next->value);
-			if (next == bucket)
-			{
-				map->valueUnion.map->buckets[bucketNum] = next->bucketNext;
-			}
-			else
-			{
-				prev->bucketNext = next->bucketNext;
-			}
-
-			if (next->insertPrev == NULL)
-			{
-				//// Then this was the first key
-				map->valueUnion.map->first = next->insertNext;
-			}
-			else
-			{
-				//// Otherwise the next of the previous key is the next of this key
-				next->insertPrev->insertNext = next->insertNext;
-			}
-
-			if (next->insertNext == NULL)
-			{
-				//// Then this was the last key
-				map->valueUnion.map->last = next->insertPrev;
-			}
-			else
-			{
-				//// Otherwise the previous of the next key is the previous of this key
-				next->insertNext->insertPrev = next->insertPrev;
-			}
+		//// The key had not been migrated yet; tombstone the outgoing index.
+		map->valueUnion.map->oldSlotHashes[slot & ~PRT_SLOT_IN_OLD] = PRT_SLOT_DELETED;
+		map->valueUnion.map->oldSlotNodes[slot & ~PRT_SLOT_IN_OLD] = NULL;
+	}
+	else
+	{
+		map->valueUnion.map->slotHashes[slot] = PRT_SLOT_DELETED;
+		map->valueUnion.map->slotNodes[slot] = NULL;
+		map->valueUnion.map->nDeleted = map->valueUnion.map->nDeleted + 1;
+	}
 
-			PrtFree(next);
-			map->valueUnion.map->size = map->valueUnion.map->size - 1;
-			return;
-		}
+	if (next->insertPrev == NULL)
+	{
+		//// Then this was the first key
+		map->valueUnion.map->first = next->insertNext;
+	}
+	else
+	{
+		//// Otherwise the next of the previous key is the next of this key
+		next->insertPrev->insertNext = next->insertNext;
+	}
 
-		prev = next;
-		next = next->bucketNext;
+	if (next->insertNext == NULL)
+	{
+		//// Then this was the last key
+		map->valueUnion.map->last = next->insertPrev;
+	}
+	else
+	{
+		//// Otherwise the previous of the next key is the previous of this key
+		next->insertNext->insertPrev = next->insertPrev;
 	}
+
+	PrtFree(next);
+	map->valueUnion.map->size = map->valueUnion.map->size - 1;
 }
 
 static PRT_MAPNODE* PrtMapGetValueNode(_Inout_ PRT_VALUE* map, _In_ PRT_VALUE* key, _In_ PRT_BOOLEAN cloneKey)
@@ -1151,35 +1692,34 @@ static PRT_MAPNODE* PrtMapGetValueNode(_Inout_ PRT_VALUE* map, _In_ PRT_VALUE* k
 	PrtAssert(PrtIsValidValue(key), "Invalid value expression.");
 	PrtAssert(map->discriminator == PRT_VALUE_KIND_MAP, "Invalid value");
 
-	const PRT_UINT32 bucket_num = PrtGetHashCodeValue(key) % PrtHashtableCapacities[map->valueUnion.map->capNum];
-	PRT_MAPNODE* bucket = map->valueUnion.map->buckets[bucket_num];
-
-	PRT_MAPNODE* next = bucket;
-	while (next != NULL)
+	const PRT_UINT32 keyHash = PrtSlotHash(PrtGetHashCodeValue(key));
+	PRT_UINT32 slot;
+	PRT_MAPNODE* next = PrtMapFindSlot(map->valueUnion.map, key, keyHash, &slot);
+	if (next != NULL)
 	{
-		if (PrtIsEqualValue(next->key, key))
+		// We own key, therefore need to free the unused key.
+		if (cloneKey != PRT_TRUE)
 		{
-			// We own key, therefore need to free the unused key.
-			if (cloneKey != PRT_TRUE)
-			{
-				PrtFreeValue(key);
-			}
-
-			return next;
+			PrtFreeValue(key);
 		}
 
-		next = next->bucketNext;
+		return next;
 	}
 
-	// If we couldn't find a node matching our key in the bucket...
+	// If we couldn't find a node matching our key in the index...
 	PRT_MAPNODE* node = (PRT_MAPNODE *)PrtMalloc(sizeof(PRT_MAPNODE));
 	PrtAssert(node != NULL, "PrtMalloc failed to allocate new map node");
 
 	node->key = cloneKey == PRT_TRUE ? PrtCloneValue(key) : key;
 	node->value = NULL;
-	node->bucketNext = bucket;
 	node->insertNext = NULL;
-	map->valueUnion.map->buckets[bucket_num] = node;
+	if (map->valueUnion.map->slotHashes[slot] == PRT_SLOT_DELETED)
+	{
+		map->valueUnion.map->nDeleted = map->valueUnion.map->nDeleted - 1;
+	}
+
+	map->valueUnion.map->slotHashes[slot] = keyHash;
+	map->valueUnion.map->slotNodes[slot] = node;
 
 	if (map->valueUnion.map->last == NULL)
 	{
@@ -1196,8 +1736,8 @@ static PRT_MAPNODE* PrtMapGetValueNode(_Inout_ PRT_VALUE* map, _In_ PRT_VALUE* k
 
 	map->valueUnion.map->size = map->valueUnion.map->size + 1;
 
-	if (((double)map->valueUnion.map->size) / ((double)PrtHashtableCapacities[map->valueUnion.map->capNum]) > ((double)
-		PRT_MAXHASHLOAD))
+	if (((double)(map->valueUnion.map->size + map->valueUnion.map->nDeleted)) / ((double)PrtHashtableCapacities[map->
+		valueUnion.map->capNum]) > ((double)PRT_MAXHASHLOAD))
 	{
 		PrtMapExpand(map);
 	}
@@ -1213,34 +1753,22 @@ PRT_VALUE** PRT_CALL_CONV PrtMapGetLValue(_Inout_ PRT_VALUE* map, _In_ PRT_VALUE
 	PrtAssert(map->discriminator == PRT_VALUE_KIND_MAP, "Map argument must be a map.");
 	PrtAssert(mapType->typeKind == PRT_KIND_MAP, "Map type argument must be a map type.");
 
+	PrtUnshareValue(map);
+	PrtMapRehashStep(map->valueUnion.map);
 	PRT_MAPNODE* node = PrtMapGetValueNode(map, key, cloneKey);
 	return &node->value;
 }
 
-PRT_VALUE* PRT_CALL_CONV PrtMapGet(_In_ PRT_VALUE* map, _In_ PRT_VALUE* key)
-{
-	PrtAssert(PrtIsValidValue(map), "Invalid value expression.");
-	PrtAssert(PrtIsValidValue(key), "Invalid value expression.");
-	PrtAssert(map->discriminator == PRT_VALUE_KIND_MAP, "Invalid value");
-
-	PRT_UINT32 bucketNum;
-	PRT_MAPNODE* bucket;
-	bucketNum = PrtGetHashCodeValue(key) % PrtHashtableCapacities[map->valueUnion.map->capNum];
-	bucket = map->valueUnion.map->buckets[bucketNum];
-	PrtAssert(bucket != NULL, "Invalid map get; key not found");
-	PRT_MAPNODE* next = bucket;
-	while (next != NULL)
-	{
-		if (PrtIsEqualValue(next->key, key))
-		{
-			return PrtCloneValue(next->value);
-		}
-
-		next = next->bucketNext;
-	}
+PRT_VALUE* PRT_CALL_CONV PrtMapGet(_In_ PRT_VALUE* map, _In_ PRT_VALUE* key)
+{
+	PrtAssert(PrtIsValidValue(map), "Invalid value expression.");
+	PrtAssert(PrtIsValidValue(key), "Invalid value expression.");
+	PrtAssert(map->discriminator == PRT_VALUE_KIND_MAP, "Invalid value");
 
-	PrtAssert(PRT_FALSE, "Invalid map get; key not found");
-	return NULL;
+	PRT_UINT32 slot;
+	PRT_MAPNODE* node = PrtMapFindSlot(map->valueUnion.map, key, PrtSlotHash(PrtGetHashCodeValue(key)), &slot);
+	PrtAssert(node != NULL, "Invalid map get; key not found");
+	return PrtCloneValue(node->value);
 }
 
 PRT_VALUE* PRT_CALL_CONV PrtMapGetNC(_In_ PRT_VALUE* map, _In_ PRT_VALUE* key)
@@ -1249,24 +1777,10 @@ PRT_VALUE* PRT_CALL_CONV PrtMapGetNC(_In_ PRT_VALUE* map, _In_ PRT_VALUE* key)
 	PrtAssert(PrtIsValidValue(key), "Invalid value expression.");
 	PrtAssert(map->discriminator == PRT_VALUE_KIND_MAP, "Invalid value");
 
-	PRT_UINT32 bucketNum;
-	PRT_MAPNODE* bucket;
-	bucketNum = PrtGetHashCodeValue(key) % PrtHashtableCapacities[map->valueUnion.map->capNum];
-	bucket = map->valueUnion.map->buckets[bucketNum];
-	PrtAssert(bucket != NULL, "Invalid map get; key not found");
-	PRT_MAPNODE* next = bucket;
-	while (next != NULL)
-	{
-		if (PrtIsEqualValue(next->key, key))
-		{
-			return next->value;
-		}
-
-		next = next->bucketNext;
-	}
-
-	PrtAssert(PRT_FALSE, "Invalid map get; key not found");
-	return NULL;
+	PRT_UINT32 slot;
+	PRT_MAPNODE* node = PrtMapFindSlot(map->valueUnion.map, key, PrtSlotHash(PrtGetHashCodeValue(key)), &slot);
+	PrtAssert(node != NULL, "Invalid map get; key not found");
+	return node->value;
 }
 
 PRT_VALUE* PRT_CALL_CONV PrtMapGetKeys(_In_ PRT_VALUE* map)
@@ -1275,29 +1789,18 @@ PRT_VALUE* PRT_CALL_CONV PrtMapGetKeys(_In_ PRT_VALUE* map)
 	PrtAssert(map->discriminator == PRT_VALUE_KIND_MAP, "Invalid value");
 
 	PRT_VALUE* retVal = (PRT_VALUE *)PrtMalloc(sizeof(PRT_VALUE));
-	PRT_SEQVALUE* seqVal = (PRT_SEQVALUE *)PrtMalloc(sizeof(PRT_SEQVALUE));
+	PRT_SEQVALUE* seqVal = PrtMkSeqPayload(map->valueUnion.map->size);
 	retVal->discriminator = PRT_VALUE_KIND_SEQ;
 	retVal->valueUnion.seq = seqVal;
+	seqVal->size = map->valueUnion.map->size;
 
-	if (map->valueUnion.map->size == 0)
-	{
-		seqVal->size = 0;
-		seqVal->capacity = 0;
-		seqVal->values = NULL;
-	}
-	else
+	PRT_MAPNODE* next = map->valueUnion.map->first;
+	PRT_UINT32 i = 0;
+	while (next != NULL)
 	{
-		seqVal->size = map->valueUnion.map->size;
-		seqVal->capacity = map->valueUnion.map->size;
-		seqVal->values = (PRT_VALUE **)PrtCalloc(map->valueUnion.map->size, sizeof(PRT_VALUE*));
-		PRT_MAPNODE* next = map->valueUnion.map->first;
-		PRT_UINT32 i = 0;
-		while (next != NULL)
-		{
-			seqVal->values[i] = PrtCloneValue(next->key);
-			++i;
-			next = next->insertNext;
-		}
+		seqVal->values[i] = PrtCloneValue(next->key);
+		++i;
+		next = next->insertNext;
 	}
 	return retVal;
 }
@@ -1308,29 +1811,18 @@ PRT_VALUE* PRT_CALL_CONV PrtMapGetValues(_In_ PRT_VALUE* map)
 	PrtAssert(map->discriminator == PRT_VALUE_KIND_MAP, "Invalid value");
 
 	PRT_VALUE* retVal = (PRT_VALUE *)PrtMalloc(sizeof(PRT_VALUE));
-	PRT_SEQVALUE* seqVal = (PRT_SEQVALUE *)PrtMalloc(sizeof(PRT_SEQVALUE));
+	PRT_SEQVALUE* seqVal = PrtMkSeqPayload(map->valueUnion.map->size);
 	retVal->discriminator = PRT_VALUE_KIND_SEQ;
 	retVal->valueUnion.seq = seqVal;
+	seqVal->size = map->valueUnion.map->size;
 
-	if (map->valueUnion.map->size == 0)
-	{
-		seqVal->size = 0;
-		seqVal->capacity = 0;
-		seqVal->values = NULL;
-	}
-	else
+	PRT_MAPNODE* next = map->valueUnion.map->first;
+	PRT_UINT32 i = 0;
+	while (next != NULL)
 	{
-		seqVal->size = map->valueUnion.map->size;
-		seqVal->capacity = map->valueUnion.map->size;
-		seqVal->values = (PRT_VALUE **)PrtCalloc(map->valueUnion.map->size, sizeof(PRT_VALUE*));
-		PRT_MAPNODE* next = map->valueUnion.map->first;
-		PRT_UINT32 i = 0;
-		while (next != NULL)
-		{
-			seqVal->values[i] = PrtCloneValue(next->value);
-			++i;
-			next = next->insertNext;
-		}
+		seqVal->values[i] = PrtCloneValue(next->value);
+		++i;
+		next = next->insertNext;
 	}
 
 	return retVal;
@@ -1342,27 +1834,9 @@ PRT_BOOLEAN PRT_CALL_CONV PrtMapExists(_In_ PRT_VALUE* map, _In_ PRT_VALUE* key)
 	PrtAssert(PrtIsValidValue(key), "Invalid value expression.");
 	PrtAssert((map->discriminator == PRT_VALUE_KIND_MAP), "Invalid value");
 
-	PRT_UINT32 bucketNum;
-	PRT_MAPNODE* bucket;
-	bucketNum = PrtGetHashCodeValue(key) % PrtHashtableCapacities[map->valueUnion.map->capNum];
-	bucket = map->valueUnion.map->buckets[bucketNum];
-	if (bucket == NULL)
-	{
-		return PRT_FALSE;
-	}
-
-	PRT_MAPNODE* next = bucket;
-	while (next != NULL)
-	{
-		if (PrtIsEqualValue(next->key, key))
-		{
-			return PRT_TRUE;
-		}
-
-		next = next->bucketNext;
-	}
-
-	return PRT_FALSE;
+	PRT_UINT32 slot;
+	PRT_MAPNODE* node = PrtMapFindSlot(map->valueUnion.map, key, PrtSlotHash(PrtGetHashCodeValue(key)), &slot);
+	return node == NULL ? PRT_FALSE : PRT_TRUE;
 }
 
 static PRT_BOOLEAN PRT_CALL_CONV PrtMapIsSameMapping(_In_ PRT_VALUE* map, _In_ PRT_VALUE* key, _In_ PRT_VALUE* value)
@@ -1372,27 +1846,14 @@ static PRT_BOOLEAN PRT_CALL_CONV PrtMapIsSameMapping(_In_ PRT_VALUE* map, _In_ P
 	PrtAssert(PrtIsValidValue(value), "Invalid value expression.");
 	PrtAssert(map->discriminator == PRT_VALUE_KIND_MAP, "Invalid value");
 
-	PRT_UINT32 bucketNum;
-	PRT_MAPNODE* bucket;
-	bucketNum = PrtGetHashCodeValue(key) % PrtHashtableCapacities[map->valueUnion.map->capNum];
-	bucket = map->valueUnion.map->buckets[bucketNum];
-	if (bucket == NULL)
+	PRT_UINT32 slot;
+	PRT_MAPNODE* node = PrtMapFindSlot(map->valueUnion.map, key, PrtSlotHash(PrtGetHashCodeValue(key)), &slot);
+	if (node == NULL)
 	{
 		return PRT_FALSE;
 	}
 
-	PRT_MAPNODE* next = bucket;
-	while (next != NULL)
-	{
-		if (PrtIsEqualValue(next->key, key))
-		{
-			return PrtIsEqualValue(next->value, value);
-		}
-
-		next = next->bucketNext;
-	}
-
-	return PRT_FALSE;
+	return PrtIsEqualValue(node->value, value);
 }
 
 PRT_UINT32 PRT_CALL_CONV PrtMapSizeOf(_In_ PRT_VALUE* map)
@@ -1751,12 +2212,24 @@ PRT_VALUE* PRT_CALL_CONV PrtCloneValue(_In_ PRT_VALUE* value)
 	case PRT_VALUE_KIND_MAP:
 	{
 		PRT_VALUE* retVal = (PRT_VALUE*)PrtMalloc(sizeof(PRT_VALUE));
-		PRT_MAPVALUE* map = (PRT_MAPVALUE *)PrtMalloc(sizeof(PRT_MAPVALUE));
 		retVal->discriminator = PRT_VALUE_KIND_MAP;
+#ifdef PRT_USE_COW
+		retVal->valueUnion.map = value->valueUnion.map;
+		PrtSharedRefIncr(retVal->valueUnion.map->refCount);
+		return retVal;
+#else
+		PRT_MAPVALUE* map = (PRT_MAPVALUE *)PrtMalloc(sizeof(PRT_MAPVALUE));
 		retVal->valueUnion.map = map;
 		PRT_MAPVALUE* mVal = value->valueUnion.map;
-		map->buckets = (PRT_MAPNODE **)PrtCalloc(PrtHashtableCapacities[mVal->capNum], sizeof(PRT_MAPNODE *));
+		map->refCount = 1;
+		map->slotHashes = (PRT_UINT32 *)PrtCalloc(PrtHashtableCapacities[mVal->capNum], sizeof(PRT_UINT32));
+		map->slotNodes = (PRT_MAPNODE **)PrtCalloc(PrtHashtableCapacities[mVal->capNum], sizeof(PRT_MAPNODE *));
+		map->oldSlotHashes = NULL;
+		map->oldSlotNodes = NULL;
+		map->oldCapNum = 0;
+		map->rehashIndex = 0;
 		map->capNum = mVal->capNum;
+		map->nDeleted = 0;
 		map->size = 0;
 		map->first = NULL;
 		map->last = NULL;
@@ -1768,17 +2241,30 @@ PRT_VALUE* PRT_CALL_CONV PrtCloneValue(_In_ PRT_VALUE* value)
 		}
 
 		return retVal;
+#endif
 	}
 
 	case PRT_VALUE_KIND_SET:
 		{
 			PRT_VALUE* retVal = (PRT_VALUE*)PrtMalloc(sizeof(PRT_VALUE));
-			PRT_SETVALUE* set = (PRT_SETVALUE *)PrtMalloc(sizeof(PRT_SETVALUE));
 			retVal->discriminator = PRT_VALUE_KIND_SET;
+#ifdef PRT_USE_COW
+			retVal->valueUnion.set = value->valueUnion.set;
+			PrtSharedRefIncr(retVal->valueUnion.set->refCount);
+			return retVal;
+#else
+			PRT_SETVALUE* set = (PRT_SETVALUE *)PrtMalloc(sizeof(PRT_SETVALUE));
 			retVal->valueUnion.set = set;
 			PRT_SETVALUE* uVal = value->valueUnion.set;
-			set->buckets = (PRT_SETNODE **)PrtCalloc(PrtHashtableCapacities[uVal->capNum], sizeof(PRT_SETNODE *));
+			set->refCount = 1;
+			set->slotHashes = (PRT_UINT32 *)PrtCalloc(PrtHashtableCapacities[uVal->capNum], sizeof(PRT_UINT32));
+			set->slotNodes = (PRT_SETNODE **)PrtCalloc(PrtHashtableCapacities[uVal->capNum], sizeof(PRT_SETNODE *));
+			set->oldSlotHashes = NULL;
+			set->oldSlotNodes = NULL;
+			set->oldCapNum = 0;
+			set->rehashIndex = 0;
 			set->capNum = uVal->capNum;
+			set->nDeleted = 0;
 			set->size = 0;
 			set->first = NULL;
 			set->last = NULL;
@@ -1790,52 +2276,51 @@ PRT_VALUE* PRT_CALL_CONV PrtCloneValue(_In_ PRT_VALUE* value)
 			}
 
 			return retVal;
+#endif
 		}
 
 	case PRT_VALUE_KIND_TUPLE:
 	{
 		PRT_VALUE* retVal = (PRT_VALUE *)PrtMalloc(sizeof(PRT_VALUE));
-		PRT_TUPVALUE* cVal = (PRT_TUPVALUE *)PrtMalloc(sizeof(PRT_TUPVALUE));
 		retVal->discriminator = PRT_VALUE_KIND_TUPLE;
-		retVal->valueUnion.tuple = cVal;
-
+#ifdef PRT_USE_COW
+		retVal->valueUnion.tuple = value->valueUnion.tuple;
+		PrtSharedRefIncr(retVal->valueUnion.tuple->refCount);
+		return retVal;
+#else
 		PRT_UINT32 i;
 		PRT_TUPVALUE* tVal = value->valueUnion.tuple;
 		PRT_UINT32 arity = value->valueUnion.tuple->size;
-		cVal->size = arity;
-		cVal->values = (PRT_VALUE **)PrtCalloc(arity, sizeof(PRT_VALUE *));
+		PRT_TUPVALUE* cVal = PrtMkTuplePayload(arity);
+		retVal->valueUnion.tuple = cVal;
 		for (i = 0; i < arity; ++i)
 		{
 			cVal->values[i] = PrtCloneValue(tVal->values[i]);
 		}
 
 		return retVal;
+#endif
 	}
 	case PRT_VALUE_KIND_SEQ:
 	{
 		PRT_VALUE* retVal = (PRT_VALUE *)PrtMalloc(sizeof(PRT_VALUE));
-		PRT_SEQVALUE* cVal = (PRT_SEQVALUE *)PrtMalloc(sizeof(PRT_SEQVALUE));
 		retVal->discriminator = PRT_VALUE_KIND_SEQ;
-		retVal->valueUnion.seq = cVal;
-
+#ifdef PRT_USE_COW
+		retVal->valueUnion.seq = value->valueUnion.seq;
+		PrtSharedRefIncr(retVal->valueUnion.seq->refCount);
+		return retVal;
+#else
 		PRT_SEQVALUE* sVal = value->valueUnion.seq;
-		cVal->capacity = sVal->capacity;
+		PRT_SEQVALUE* cVal = PrtMkSeqPayload(sVal->size);
+		retVal->valueUnion.seq = cVal;
 		cVal->size = sVal->size;
-		if (sVal->capacity == 0)
-		{
-			cVal->values = NULL;
-		}
-		else
+		for (PRT_UINT32 i = 0; i < sVal->size; ++i)
 		{
-			PRT_UINT32 i;
-			cVal->values = (PRT_VALUE **)PrtCalloc(sVal->capacity, sizeof(PRT_VALUE *));
-			for (i = 0; i < sVal->size; ++i)
-			{
-				cVal->values[i] = PrtCloneValue(sVal->values[i]);
-			}
+			cVal->values[i] = PrtCloneValue(sVal->values[i]);
 		}
 
 		return retVal;
+#endif
 	}
 	default:
 		PrtAssert(PRT_FALSE, "PrtCloneValue: Invalid value");
@@ -2093,7 +2578,7 @@ void PRT_CALL_CONV PrtFreeValue(_Inout_ PRT_VALUE* value)
 	case PRT_VALUE_KIND_FLOAT:
 	case PRT_VALUE_KIND_NULL:
 	{
-		PrtFree(value);
+		PrtFreeScalarValue(value);
 		break;
 	}
 	case PRT_VALUE_KIND_STRING:
@@ -2106,7 +2591,7 @@ void PRT_CALL_CONV PrtFreeValue(_Inout_ PRT_VALUE* value)
 	{
 		PRT_MACHINEID* id = value->valueUnion.mid;
 		PrtFree(id);
-		PrtFree(value);
+		PrtFreeScalarValue(value);
 		break;
 	}
 	case PRT_VALUE_KIND_FOREIGN:
@@ -2120,70 +2605,44 @@ void PRT_CALL_CONV PrtFreeValue(_Inout_ PRT_VALUE* value)
 	case PRT_VALUE_KIND_MAP:
 	{
 		PRT_MAPVALUE* mVal = value->valueUnion.map;
-		PRT_MAPNODE* next = mVal->first;
-		PRT_MAPNODE* tmp;
-		while (next != NULL)
+		if (PrtSharedRefDecr(mVal->refCount) == 0)
 		{
-			tmp = next->insertNext;
-			PrtFreeValue(next->key);
-			PrtFreeValue(next->value);
-			PrtFree(next);
-			next = tmp;
+			PrtFreeMapPayload(mVal);
 		}
 
-		PrtFree(mVal->buckets);
-		PrtFree(mVal);
 		PrtFree(value);
 		break;
 	}
 	case PRT_VALUE_KIND_SET:
 	{
 		PRT_SETVALUE* uVal = value->valueUnion.set;
-		PRT_SETNODE* next = uVal->first;
-		PRT_SETNODE* tmp;
-		while (next != NULL)
+		if (PrtSharedRefDecr(uVal->refCount) == 0)
 		{
-			tmp = next->insertNext;
-			PrtFreeValue(next->item);
-			PrtFree(next);
-			next = tmp;
+			PrtFreeSetPayload(uVal);
 		}
 
-		PrtFree(uVal->buckets);
-		PrtFree(uVal);
 		PrtFree(value);
 		break;
 	}
 	case PRT_VALUE_KIND_TUPLE:
 	{
-		PRT_UINT32 i;
 		PRT_TUPVALUE* tVal = value->valueUnion.tuple;
-		PRT_UINT32 arity = tVal->size;
-		for (i = 0; i < arity; ++i)
+		if (PrtSharedRefDecr(tVal->refCount) == 0)
 		{
-			PrtFreeValue(tVal->values[i]);
+			PrtFreeTuplePayload(tVal);
 		}
 
-		PrtFree(tVal->values);
-		PrtFree(tVal);
 		PrtFree(value);
 		break;
 	}
 	case PRT_VALUE_KIND_SEQ:
 	{
 		PRT_SEQVALUE* sVal = value->valueUnion.seq;
-		if (sVal->values != NULL)
+		if (PrtSharedRefDecr(sVal->refCount) == 0)
 		{
-			PRT_UINT32 i;
-			for (i = 0; i < sVal->size; ++i)
-			{
-				PrtFreeValue(sVal->values[i]);
-			}
-
-			PrtFree(sVal->values);
+			PrtFreeSeqPayload(sVal);
 		}
 
-		PrtFree(sVal);
 		PrtFree(value);
 		break;
 	}
@@ -2248,4 +2707,380 @@ PRT_BOOLEAN PRT_CALL_CONV PrtIsValidValue(_In_ PRT_VALUE* value)
 PRT_VALUE* PRT_CALL_CONV PrtMkNondetBoolValue()
 {
 	return PrtMkBoolValue(PrtChoose());
-}
\ No newline at end of file
+}
+/*********************************************************************************
+
+Binary serialization
+
+Values are encoded as a 32-bit kind tag followed by a kind-specific payload;
+composite values carry a 32-bit element count, so the encoding is
+self-delimiting and needs no schema on the wire. Sequences whose elements all
+share one scalar kind are written as a raw array without per-element tags.
+Scalar widths follow the build's PRT_INT/PRT_FLOAT, so the format is meant for
+exchange between identically built processes, not for persistent storage.
+
+*********************************************************************************/
+
+/** The element-kind marker for sequences with mixed or non-scalar elements. */
+#define PRT_SERIAL_MIXED_ELEMENTS 0xffffffff
+
+typedef struct PRT_SERIALBUF
+{
+	PRT_UINT8* buffer; /**< The wire buffer (NULL when only measuring) */
+	PRT_UINT32 size; /**< The usable bytes in buffer                 */
+	PRT_UINT32 offset; /**< The read/write cursor                      */
+} PRT_SERIALBUF;
+
+static void PrtSerialWrite(_Inout_ PRT_SERIALBUF* buf, _In_ const void* data, _In_ PRT_UINT32 nBytes)
+{
+	if (buf->buffer != NULL)
+	{
+		PrtAssert(buf->offset + nBytes <= buf->size, "Serialization buffer too small");
+		memcpy(buf->buffer + buf->offset, data, nBytes);
+	}
+	buf->offset += nBytes;
+}
+
+static void PrtSerialWriteUInt32(_Inout_ PRT_SERIALBUF* buf, _In_ PRT_UINT32 value)
+{
+	PrtSerialWrite(buf, &value, sizeof(value));
+}
+
+static void PrtSerialRead(_Inout_ PRT_SERIALBUF* buf, _Out_ void* data, _In_ PRT_UINT32 nBytes)
+{
+	PrtAssert(buf->offset + nBytes <= buf->size, "Truncated serialized value");
+	memcpy(data, buf->buffer + buf->offset, nBytes);
+	buf->offset += nBytes;
+}
+
+static PRT_UINT32 PrtSerialReadUInt32(_Inout_ PRT_SERIALBUF* buf)
+{
+	PRT_UINT32 value;
+	PrtSerialRead(buf, &value, sizeof(value));
+	return value;
+}
+
+/** Returns the shared scalar kind of all elements, or PRT_SERIAL_MIXED_ELEMENTS. */
+static PRT_UINT32 PrtSerialElementKind(_In_ PRT_SEQVALUE* seqVal)
+{
+	if (seqVal->size == 0)
+	{
+		return PRT_SERIAL_MIXED_ELEMENTS;
+	}
+
+	const PRT_VALUE_KIND kind = seqVal->values[0]->discriminator;
+	switch (kind)
+	{
+	case PRT_VALUE_KIND_NULL:
+	case PRT_VALUE_KIND_BOOL:
+	case PRT_VALUE_KIND_INT:
+	case PRT_VALUE_KIND_FLOAT:
+	case PRT_VALUE_KIND_EVENT:
+		break;
+	default:
+		return PRT_SERIAL_MIXED_ELEMENTS;
+	}
+
+	for (PRT_UINT32 i = 1; i < seqVal->size; i++)
+	{
+		if (seqVal->values[i]->discriminator != kind)
+		{
+			return PRT_SERIAL_MIXED_ELEMENTS;
+		}
+	}
+
+	return (PRT_UINT32)kind;
+}
+
+static void PrtSerializeValueRec(_Inout_ PRT_SERIALBUF* buf, _In_ PRT_VALUE* value)
+{
+	PrtSerialWriteUInt32(buf, (PRT_UINT32)value->discriminator);
+	switch (value->discriminator)
+	{
+	case PRT_VALUE_KIND_NULL:
+		break;
+	case PRT_VALUE_KIND_BOOL:
+	{
+		PRT_UINT32 bl = (PRT_UINT32)value->valueUnion.bl;
+		PrtSerialWrite(buf, &bl, sizeof(bl));
+		break;
+	}
+	case PRT_VALUE_KIND_INT:
+		PrtSerialWrite(buf, &value->valueUnion.nt, sizeof(value->valueUnion.nt));
+		break;
+	case PRT_VALUE_KIND_FLOAT:
+		PrtSerialWrite(buf, &value->valueUnion.ft, sizeof(value->valueUnion.ft));
+		break;
+	case PRT_VALUE_KIND_EVENT:
+		PrtSerialWriteUInt32(buf, value->valueUnion.ev);
+		break;
+	case PRT_VALUE_KIND_STRING:
+	{
+		PRT_UINT32 length = (PRT_UINT32)strlen(value->valueUnion.str);
+		PrtSerialWriteUInt32(buf, length);
+		PrtSerialWrite(buf, value->valueUnion.str, length * (PRT_UINT32)sizeof(PRT_CHAR));
+		break;
+	}
+	case PRT_VALUE_KIND_MID:
+		PrtSerialWrite(buf, value->valueUnion.mid, sizeof(PRT_MACHINEID));
+		break;
+	case PRT_VALUE_KIND_TUPLE:
+	{
+		PRT_TUPVALUE* tupVal = value->valueUnion.tuple;
+		PrtSerialWriteUInt32(buf, tupVal->size);
+		for (PRT_UINT32 i = 0; i < tupVal->size; i++)
+		{
+			PrtSerializeValueRec(buf, tupVal->values[i]);
+		}
+		break;
+	}
+	case PRT_VALUE_KIND_SEQ:
+	{
+		PRT_SEQVALUE* seqVal = value->valueUnion.seq;
+		const PRT_UINT32 elemKind = PrtSerialElementKind(seqVal);
+		PrtSerialWriteUInt32(buf, seqVal->size);
+		PrtSerialWriteUInt32(buf, elemKind);
+		for (PRT_UINT32 i = 0; i < seqVal->size; i++)
+		{
+			switch (elemKind)
+			{
+			case PRT_VALUE_KIND_NULL:
+				break;
+			case PRT_VALUE_KIND_BOOL:
+			{
+				PRT_UINT32 bl = (PRT_UINT32)seqVal->values[i]->valueUnion.bl;
+				PrtSerialWrite(buf, &bl, sizeof(bl));
+				break;
+			}
+			case PRT_VALUE_KIND_INT:
+				PrtSerialWrite(buf, &seqVal->values[i]->valueUnion.nt, sizeof(seqVal->values[i]->valueUnion.nt));
+				break;
+			case PRT_VALUE_KIND_FLOAT:
+				PrtSerialWrite(buf, &seqVal->values[i]->valueUnion.ft, sizeof(seqVal->values[i]->valueUnion.ft));
+				break;
+			case PRT_VALUE_KIND_EVENT:
+				PrtSerialWriteUInt32(buf, seqVal->values[i]->valueUnion.ev);
+				break;
+			default:
+				PrtSerializeValueRec(buf, seqVal->values[i]);
+				break;
+			}
+		}
+		break;
+	}
+	case PRT_VALUE_KIND_SET:
+	{
+		PRT_SETVALUE* setVal = value->valueUnion.set;
+		PrtSerialWriteUInt32(buf, setVal->size);
+		for (PRT_SETNODE* node = setVal->first; node != NULL; node = node->insertNext)
+		{
+			PrtSerializeValueRec(buf, node->item);
+		}
+		break;
+	}
+	case PRT_VALUE_KIND_MAP:
+	{
+		PRT_MAPVALUE* mapVal = value->valueUnion.map;
+		PrtSerialWriteUInt32(buf, mapVal->size);
+		for (PRT_MAPNODE* node = mapVal->first; node != NULL; node = node->insertNext)
+		{
+			PrtSerializeValueRec(buf, node->key);
+			PrtSerializeValueRec(buf, node->value);
+		}
+		break;
+	}
+	case PRT_VALUE_KIND_FOREIGN:
+	default:
+		PrtAssert(PRT_FALSE, "PrtSerializeValue: cannot serialize this value kind");
+		break;
+	}
+}
+
+static PRT_VALUE* PrtMkEmptySetValue(void)
+{
+	PRT_VALUE* retVal = (PRT_VALUE*)PrtMalloc(sizeof(PRT_VALUE));
+	PRT_SETVALUE* set = (PRT_SETVALUE *)PrtMalloc(sizeof(PRT_SETVALUE));
+	retVal->discriminator = PRT_VALUE_KIND_SET;
+	retVal->valueUnion.set = set;
+	set->refCount = 1;
+	set->size = 0;
+	set->capNum = 0;
+	set->nDeleted = 0;
+	set->slotHashes = (PRT_UINT32 *)PrtCalloc(PrtHashtableCapacities[0], sizeof(PRT_UINT32));
+	set->slotNodes = (PRT_SETNODE **)PrtCalloc(PrtHashtableCapacities[0], sizeof(PRT_SETNODE *));
+	set->oldSlotHashes = NULL;
+	set->oldSlotNodes = NULL;
+	set->oldCapNum = 0;
+	set->rehashIndex = 0;
+	set->first = NULL;
+	set->last = NULL;
+	return retVal;
+}
+
+static PRT_VALUE* PrtMkEmptyMapValue(void)
+{
+	PRT_VALUE* retVal = (PRT_VALUE*)PrtMalloc(sizeof(PRT_VALUE));
+	PRT_MAPVALUE* map = (PRT_MAPVALUE *)PrtMalloc(sizeof(PRT_MAPVALUE));
+	retVal->discriminator = PRT_VALUE_KIND_MAP;
+	retVal->valueUnion.map = map;
+	map->refCount = 1;
+	map->size = 0;
+	map->capNum = 0;
+	map->nDeleted = 0;
+	map->slotHashes = (PRT_UINT32 *)PrtCalloc(PrtHashtableCapacities[0], sizeof(PRT_UINT32));
+	map->slotNodes = (PRT_MAPNODE **)PrtCalloc(PrtHashtableCapacities[0], sizeof(PRT_MAPNODE *));
+	map->oldSlotHashes = NULL;
+	map->oldSlotNodes = NULL;
+	map->oldCapNum = 0;
+	map->rehashIndex = 0;
+	map->first = NULL;
+	map->last = NULL;
+	return retVal;
+}
+
+static PRT_VALUE* PrtDeserializeValueRec(_Inout_ PRT_SERIALBUF* buf)
+{
+	const PRT_UINT32 kind = PrtSerialReadUInt32(buf);
+	switch ((PRT_VALUE_KIND)kind)
+	{
+	case PRT_VALUE_KIND_NULL:
+		return PrtMkNullValue();
+	case PRT_VALUE_KIND_BOOL:
+		return PrtMkBoolValue((PRT_BOOLEAN)PrtSerialReadUInt32(buf));
+	case PRT_VALUE_KIND_INT:
+	{
+		PRT_INT nt;
+		PrtSerialRead(buf, &nt, sizeof(nt));
+		return PrtMkIntValue(nt);
+	}
+	case PRT_VALUE_KIND_FLOAT:
+	{
+		PRT_FLOAT ft;
+		PrtSerialRead(buf, &ft, sizeof(ft));
+		return PrtMkFloatValue(ft);
+	}
+	case PRT_VALUE_KIND_EVENT:
+		return PrtMkEventValue(PrtSerialReadUInt32(buf));
+	case PRT_VALUE_KIND_STRING:
+	{
+		const PRT_UINT32 length = PrtSerialReadUInt32(buf);
+		PRT_STRING str = (PRT_STRING)PrtCalloc(length + 1, sizeof(PRT_CHAR));
+		PrtSerialRead(buf, str, length * (PRT_UINT32)sizeof(PRT_CHAR));
+		return PrtMkStringValue(str);
+	}
+	case PRT_VALUE_KIND_MID:
+	{
+		PRT_MACHINEID mid;
+		PrtSerialRead(buf, &mid, sizeof(mid));
+		return PrtMkMachineValue(mid);
+	}
+	case PRT_VALUE_KIND_TUPLE:
+	{
+		const PRT_UINT32 size = PrtSerialReadUInt32(buf);
+		PRT_VALUE* retVal = (PRT_VALUE*)PrtMalloc(sizeof(PRT_VALUE));
+		PRT_TUPVALUE* tup = PrtMkTuplePayload(size);
+		retVal->discriminator = PRT_VALUE_KIND_TUPLE;
+		retVal->valueUnion.tuple = tup;
+		for (PRT_UINT32 i = 0; i < size; i++)
+		{
+			tup->values[i] = PrtDeserializeValueRec(buf);
+		}
+		return retVal;
+	}
+	case PRT_VALUE_KIND_SEQ:
+	{
+		const PRT_UINT32 size = PrtSerialReadUInt32(buf);
+		const PRT_UINT32 elemKind = PrtSerialReadUInt32(buf);
+		PRT_VALUE* retVal = (PRT_VALUE*)PrtMalloc(sizeof(PRT_VALUE));
+		PRT_SEQVALUE* seq = PrtMkSeqPayload(size);
+		retVal->discriminator = PRT_VALUE_KIND_SEQ;
+		retVal->valueUnion.seq = seq;
+		seq->size = size;
+		for (PRT_UINT32 i = 0; i < size; i++)
+		{
+			switch (elemKind)
+			{
+			case PRT_VALUE_KIND_NULL:
+				seq->values[i] = PrtMkNullValue();
+				break;
+			case PRT_VALUE_KIND_BOOL:
+				seq->values[i] = PrtMkBoolValue((PRT_BOOLEAN)PrtSerialReadUInt32(buf));
+				break;
+			case PRT_VALUE_KIND_INT:
+			{
+				PRT_INT nt;
+				PrtSerialRead(buf, &nt, sizeof(nt));
+				seq->values[i] = PrtMkIntValue(nt);
+				break;
+			}
+			case PRT_VALUE_KIND_FLOAT:
+			{
+				PRT_FLOAT ft;
+				PrtSerialRead(buf, &ft, sizeof(ft));
+				seq->values[i] = PrtMkFloatValue(ft);
+				break;
+			}
+			case PRT_VALUE_KIND_EVENT:
+				seq->values[i] = PrtMkEventValue(PrtSerialReadUInt32(buf));
+				break;
+			default:
+				seq->values[i] = PrtDeserializeValueRec(buf);
+				break;
+			}
+		}
+		return retVal;
+	}
+	case PRT_VALUE_KIND_SET:
+	{
+		const PRT_UINT32 size = PrtSerialReadUInt32(buf);
+		PRT_VALUE* retVal = PrtMkEmptySetValue();
+		for (PRT_UINT32 i = 0; i < size; i++)
+		{
+			PrtSetAddEx(retVal, PrtDeserializeValueRec(buf), PRT_FALSE);
+		}
+		return retVal;
+	}
+	case PRT_VALUE_KIND_MAP:
+	{
+		const PRT_UINT32 size = PrtSerialReadUInt32(buf);
+		PRT_VALUE* retVal = PrtMkEmptyMapValue();
+		for (PRT_UINT32 i = 0; i < size; i++)
+		{
+			PRT_VALUE* key = PrtDeserializeValueRec(buf);
+			PRT_VALUE* value = PrtDeserializeValueRec(buf);
+			PrtMapUpdateEx(retVal, key, PRT_FALSE, value, PRT_FALSE);
+		}
+		return retVal;
+	}
+	default:
+		PrtAssert(PRT_FALSE, "PrtDeserializeValue: corrupt serialized value");
+		return NULL;
+	}
+}
+
+PRT_UINT32 PRT_CALL_CONV PrtSerializeValue(
+	_In_	     PRT_VALUE* value,
+	_Out_	     PRT_UINT8* buffer,
+	_In_	     PRT_UINT32 bufferSize)
+{
+	PrtAssert(PrtIsValidValue(value), "Invalid value expression.");
+	PRT_SERIALBUF buf;
+	buf.buffer = buffer;
+	buf.size = bufferSize;
+	buf.offset = 0;
+	PrtSerializeValueRec(&buf, value);
+	return buf.offset;
+}
+
+PRT_VALUE* PRT_CALL_CONV PrtDeserializeValue(
+	_In_	     PRT_UINT8* buffer,
+	_Inout_	     PRT_UINT32* nBytes)
+{
+	PRT_SERIALBUF buf;
+	buf.buffer = buffer;
+	buf.size = *nBytes;
+	buf.offset = 0;
+	PRT_VALUE* retVal = PrtDeserializeValueRec(&buf);
+	*nBytes = buf.offset;
+	return retVal;
+}
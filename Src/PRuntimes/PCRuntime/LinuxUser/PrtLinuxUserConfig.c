@@ -1,6 +1,109 @@
 #include "PrtLinuxUserConfig.h"
 #include "Prt.h"
 
+#if defined(PRT_USE_FUTEX_LOCKS) && defined(__linux__)
+
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+/* Adaptive spin-then-futex lock backing PrtLockMutex. The per-machine
+ * stateMachineLock is taken on every send and every dequeue around critical
+ * sections of a few tens of nanoseconds, so a contended pthread recursive
+ * mutex pays a sleep/wake syscall cycle far larger than the work it guards.
+ * This lock spins briefly for the common short hold and only then parks on a
+ * futex. It stays recursive because the runtime re-enters the machine lock
+ * on a few paths (e.g. recycling trigger boxes during machine teardown). */
+
+#define PRT_LOCK_SPIN_LIMIT 128
+
+static PRT_THREAD_LOCAL pid_t prtLockTid = 0;
+
+static pid_t PrtLockSelf(void)
+{
+  if (prtLockTid == 0)
+  {
+    prtLockTid = (pid_t)syscall(SYS_gettid);
+  }
+  return prtLockTid;
+}
+
+static void PrtFutexWait(volatile PRT_UINT32 *addr, PRT_UINT32 expected)
+{
+  syscall(SYS_futex, addr, FUTEX_WAIT_PRIVATE, expected, NULL, NULL, 0);
+}
+
+static void PrtFutexWake(volatile PRT_UINT32 *addr)
+{
+  syscall(SYS_futex, addr, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+}
+
+PRT_RECURSIVE_MUTEX PRT_CALL_CONV PrtCreateMutex()
+{
+  PRT_RECURSIVE_MUTEX mutex = calloc(1, sizeof(PRT_FUTEX_MUTEX));
+  PrtAssert(mutex != NULL, "Unable to create mutex");
+  return mutex;
+}
+
+void PRT_CALL_CONV PrtDestroyMutex(_In_ PRT_RECURSIVE_MUTEX mutex)
+{
+  PrtAssert(mutex->state == 0, "Unable to release mutex");
+  free(mutex);
+}
+
+void PRT_CALL_CONV PrtLockMutex(_In_ PRT_RECURSIVE_MUTEX mutex)
+{
+  const pid_t self = PrtLockSelf();
+  if (mutex->owner == (PRT_INT32)self)
+  {
+    mutex->depth++;
+    return;
+  }
+
+  for (int spin = 0; spin < PRT_LOCK_SPIN_LIMIT; spin++)
+  {
+    if (mutex->state == 0 && __sync_bool_compare_and_swap(&mutex->state, 0, 1))
+    {
+      mutex->owner = (PRT_INT32)self;
+      mutex->depth = 1;
+      return;
+    }
+#if defined(__x86_64__) || defined(__i386__)
+    __asm__ __volatile__("pause");
+#endif
+  }
+
+  PRT_UINT32 c = __sync_val_compare_and_swap(&mutex->state, 0, 1);
+  while (c != 0)
+  {
+    if (c == 2 || __sync_val_compare_and_swap(&mutex->state, 1, 2) != 0)
+    {
+      PrtFutexWait(&mutex->state, 2);
+    }
+    c = __sync_val_compare_and_swap(&mutex->state, 0, 2);
+  }
+  mutex->owner = (PRT_INT32)self;
+  mutex->depth = 1;
+}
+
+void PRT_CALL_CONV PrtUnlockMutex(_In_ PRT_RECURSIVE_MUTEX mutex)
+{
+  PrtAssert(mutex->owner == (PRT_INT32)PrtLockSelf() && mutex->depth > 0, "Unable to unlock mutex");
+  if (--mutex->depth > 0)
+  {
+    return;
+  }
+  mutex->owner = 0;
+  if (__sync_fetch_and_sub(&mutex->state, 1) != 1)
+  {
+    mutex->state = 0;
+    __sync_synchronize();
+    PrtFutexWake(&mutex->state);
+  }
+}
+
+#else
+
 PRT_RECURSIVE_MUTEX PRT_CALL_CONV PrtCreateMutex()
 {
   pthread_mutexattr_t attr;
@@ -31,6 +134,8 @@ void PRT_CALL_CONV PrtUnlockMutex(_In_ PRT_RECURSIVE_MUTEX mutex)
   PrtAssert(result == 0, "Unable to unlock mutex");
 }
 
+#endif
+
 PRT_API PRT_SEMAPHORE PRT_CALL_CONV PrtCreateSemaphore(int initialCount, int maximumCount)
 {
 #ifdef __APPLE__
@@ -107,8 +212,245 @@ PRT_API void PRT_CALL_CONV PrtYieldThread()
     sched_yield();
 }
 
+/* Adapter from the platform-neutral thread entry signature to pthreads. */
+typedef struct PRT_THREAD_START
+{
+  void (PRT_CALL_CONV *fn)(void*);
+  void *arg;
+} PRT_THREAD_START;
+
+static void * PrtThreadTrampoline(void *arg)
+{
+  PRT_THREAD_START start = *(PRT_THREAD_START *)arg;
+  free(arg);
+  start.fn(start.arg);
+  return NULL;
+}
+
+PRT_API void * PRT_CALL_CONV PrtCreateThread(_In_ void (PRT_CALL_CONV *fn)(void*), _In_ void *arg)
+{
+  pthread_t *thread = malloc(sizeof(pthread_t));
+  PRT_THREAD_START *start = malloc(sizeof(PRT_THREAD_START));
+  if (thread == NULL || start == NULL)
+  {
+    free(thread);
+    free(start);
+    return NULL;
+  }
+  start->fn = fn;
+  start->arg = arg;
+  if (pthread_create(thread, NULL, &PrtThreadTrampoline, start) != 0)
+  {
+    free(thread);
+    free(start);
+    return NULL;
+  }
+  return thread;
+}
+
+PRT_API void PRT_CALL_CONV PrtJoinThread(_In_ void *thread)
+{
+  pthread_join(*(pthread_t *)thread, NULL);
+  free(thread);
+}
+
+/* Allocation counter behind PrtGetAllocationCount. The counter is
+ * thread-local so the increment never touches a shared cache line and the
+ * allocation paths stay uncontended. */
+static PRT_THREAD_LOCAL PRT_UINT64 prtAllocationCount = 0;
+
+PRT_API PRT_UINT64 PRT_CALL_CONV PrtGetAllocationCount(void)
+{
+  return prtAllocationCount;
+}
+
+#ifdef PRT_USE_POOLED_ALLOC
+
+/* Pooled allocator backing PrtMalloc/PrtFree. The runtime allocates vast
+ * numbers of small, identically-sized objects (PRT_VALUE boxes, map and set
+ * nodes), and under load the general-purpose heap spends a large fraction of
+ * CPU on them and fragments badly. Small requests are rounded up to a size
+ * class and served from per-thread magazines of free blocks, so the scheduler
+ * threads allocate and free without touching a shared lock in the common
+ * case. Each block carries a header recording its size class; requests larger
+ * than the biggest class fall through to malloc with a header marking them as
+ * unpooled. Empty magazines refill from a per-class global free list, or by
+ * carving a fresh slab; overfull magazines spill half their blocks back to
+ * the global list so one thread cannot hoard blocks freed on behalf of
+ * another. Slabs are never returned to the OS. */
+
+#define PRT_POOL_NUM_CLASSES 3
+#define PRT_POOL_SLAB_BLOCKS 256
+#define PRT_POOL_MAGAZINE_MAX 1024
+#define PRT_POOL_UNPOOLED ((size_t)-1)
+
+static const size_t prtPoolClassSizes[PRT_POOL_NUM_CLASSES] = { 16, 32, 64 };
+
+typedef struct PRT_POOL_BLOCK
+{
+  struct PRT_POOL_BLOCK *next; /* next free block while on a free list */
+  size_t sizeClass;            /* class index, or PRT_POOL_UNPOOLED    */
+} PRT_POOL_BLOCK;
+
+typedef struct PRT_POOL_MAGAZINE
+{
+  PRT_POOL_BLOCK *head;
+  size_t count;
+} PRT_POOL_MAGAZINE;
+
+static PRT_THREAD_LOCAL PRT_POOL_MAGAZINE prtPoolMagazines[PRT_POOL_NUM_CLASSES];
+
+static pthread_mutex_t prtPoolGlobalLock = PTHREAD_MUTEX_INITIALIZER;
+static PRT_POOL_BLOCK *prtPoolGlobalFree[PRT_POOL_NUM_CLASSES];
+static size_t prtPoolGlobalCount[PRT_POOL_NUM_CLASSES];
+
+static size_t PrtPoolClassOf(_In_ size_t size)
+{
+  size_t cls;
+  for (cls = 0; cls < PRT_POOL_NUM_CLASSES; cls++)
+  {
+    if (size <= prtPoolClassSizes[cls])
+      return cls;
+  }
+  return PRT_POOL_UNPOOLED;
+}
+
+static void PrtPoolRefillMagazine(_In_ size_t cls)
+{
+  PRT_POOL_MAGAZINE *mag = &prtPoolMagazines[cls];
+
+  pthread_mutex_lock(&prtPoolGlobalLock);
+  while (prtPoolGlobalFree[cls] != NULL && mag->count < PRT_POOL_SLAB_BLOCKS)
+  {
+    PRT_POOL_BLOCK *block = prtPoolGlobalFree[cls];
+    prtPoolGlobalFree[cls] = block->next;
+    prtPoolGlobalCount[cls]--;
+    block->next = mag->head;
+    mag->head = block;
+    mag->count++;
+  }
+  pthread_mutex_unlock(&prtPoolGlobalLock);
+
+  if (mag->head != NULL)
+    return;
+
+  /* Carve a fresh slab straight into this thread's magazine. */
+  const size_t blockSize = sizeof(PRT_POOL_BLOCK) + prtPoolClassSizes[cls];
+  char *slab = malloc(PRT_POOL_SLAB_BLOCKS * blockSize);
+  PrtAssert(slab != NULL, "Memory allocation error");
+  size_t i;
+  for (i = 0; i < PRT_POOL_SLAB_BLOCKS; i++)
+  {
+    PRT_POOL_BLOCK *block = (PRT_POOL_BLOCK *)(slab + i * blockSize);
+    block->next = mag->head;
+    mag->head = block;
+  }
+  mag->count += PRT_POOL_SLAB_BLOCKS;
+}
+
+static void PrtPoolSpillMagazine(_In_ size_t cls)
+{
+  PRT_POOL_MAGAZINE *mag = &prtPoolMagazines[cls];
+
+  pthread_mutex_lock(&prtPoolGlobalLock);
+  while (mag->count > PRT_POOL_MAGAZINE_MAX / 2)
+  {
+    PRT_POOL_BLOCK *block = mag->head;
+    mag->head = block->next;
+    mag->count--;
+    block->next = prtPoolGlobalFree[cls];
+    prtPoolGlobalFree[cls] = block;
+    prtPoolGlobalCount[cls]++;
+  }
+  pthread_mutex_unlock(&prtPoolGlobalLock);
+}
+
+void * PRT_CALL_CONV PrtMalloc(_In_ size_t size)
+{
+  prtAllocationCount++;
+  const size_t cls = PrtPoolClassOf(size);
+  PRT_POOL_BLOCK *block;
+  if (cls == PRT_POOL_UNPOOLED)
+  {
+    block = malloc(sizeof(PRT_POOL_BLOCK) + size);
+    PrtAssert(block != NULL, "Memory allocation error");
+    block->sizeClass = PRT_POOL_UNPOOLED;
+    return block + 1;
+  }
+
+  PRT_POOL_MAGAZINE *mag = &prtPoolMagazines[cls];
+  if (mag->head == NULL)
+  {
+    PrtPoolRefillMagazine(cls);
+  }
+
+  block = mag->head;
+  mag->head = block->next;
+  mag->count--;
+  block->sizeClass = cls;
+  return block + 1;
+}
+
+void * PRT_CALL_CONV PrtCalloc(_In_ size_t nmemb, _In_ size_t size)
+{
+  PrtAssert(size > 0, "Size must be positive to avoid platform-specific behavior");
+  PrtAssert(nmemb > 0, "Size must be positive to avoid platform-specific behavior");
+
+  void *ptr = PrtMalloc(nmemb * size);
+  memset(ptr, 0, nmemb * size);
+  return ptr;
+}
+
+void * PRT_CALL_CONV PrtRealloc(_Inout_ void *ptr, _In_ size_t size)
+{
+  if (ptr == NULL)
+    return PrtMalloc(size);
+
+  PRT_POOL_BLOCK *block = (PRT_POOL_BLOCK *)ptr - 1;
+  if (block->sizeClass == PRT_POOL_UNPOOLED)
+  {
+    block = realloc(block, sizeof(PRT_POOL_BLOCK) + size);
+    PrtAssert(block != NULL, "Memory allocation error");
+    return block + 1;
+  }
+
+  if (size <= prtPoolClassSizes[block->sizeClass])
+    return ptr;
+
+  void *newPtr = PrtMalloc(size);
+  memcpy(newPtr, ptr, prtPoolClassSizes[block->sizeClass]);
+  PrtFree(ptr);
+  return newPtr;
+}
+
+void PRT_CALL_CONV PrtFree(void *ptr)
+{
+  if (ptr == NULL)
+    return;
+
+  PRT_POOL_BLOCK *block = (PRT_POOL_BLOCK *)ptr - 1;
+  const size_t cls = block->sizeClass;
+  if (cls == PRT_POOL_UNPOOLED)
+  {
+    free(block);
+    return;
+  }
+
+  PRT_POOL_MAGAZINE *mag = &prtPoolMagazines[cls];
+  block->next = mag->head;
+  mag->head = block;
+  mag->count++;
+  if (mag->count > PRT_POOL_MAGAZINE_MAX)
+  {
+    PrtPoolSpillMagazine(cls);
+  }
+}
+
+#else
+
 void * PRT_CALL_CONV PrtMalloc(_In_ size_t size)
 {
+  prtAllocationCount++;
   void *ptr = malloc(size);
   return ptr;
 }
@@ -118,6 +460,7 @@ void * PRT_CALL_CONV PrtCalloc(_In_ size_t nmemb, _In_ size_t size)
   PrtAssert(size > 0, "Size must be positive to avoid platform-specific behavior");
   PrtAssert(nmemb > 0, "Size must be positive to avoid platform-specific behavior");
 
+  prtAllocationCount++;
   void *ptr = calloc(nmemb, size);
   PrtAssert(ptr != NULL, "Memory allocation error");
   return ptr;
@@ -134,6 +477,8 @@ void PRT_CALL_CONV PrtFree(void *ptr)
   free(ptr);
 }
 
+#endif
+
 PRT_BOOLEAN PRT_CALL_CONV PrtChoose()
 {
   PRT_UINT32 value = rand();
@@ -14,6 +14,9 @@
 #define FORCEINLINE
 #endif
 
+/** Thread-local storage */
+#define PRT_THREAD_LOCAL __thread
+
 #ifdef __cplusplus
 extern "C"{
 #endif
@@ -90,7 +93,18 @@ extern "C"{
 	typedef char const * PRT_CSTRING;
 
 	/** PRT_RECURSIVE_MUTEX identifies a recursive mutex. */
+#if defined(PRT_USE_FUTEX_LOCKS) && defined(__linux__)
+	/** Adaptive spin-then-futex recursive lock (see PrtLinuxUserConfig.c). */
+	typedef struct PRT_FUTEX_MUTEX
+	{
+		volatile PRT_UINT32 state; /**< 0 free, 1 held, 2 held with waiters */
+		volatile PRT_INT32 owner; /**< Thread id of the holder, 0 when free */
+		PRT_UINT32 depth; /**< Recursive acquisition depth */
+	} PRT_FUTEX_MUTEX;
+	typedef PRT_FUTEX_MUTEX* PRT_RECURSIVE_MUTEX;
+#else
 	typedef pthread_mutex_t* PRT_RECURSIVE_MUTEX;
+#endif
 
     /** PRT_SEMAPHORE identifies a platform specific semaphore object. */
 #ifdef __APPLE__
@@ -99,6 +113,14 @@ extern "C"{
     typedef sem_t* PRT_SEMAPHORE;
 #endif
 
+	/** Returns the number of PrtMalloc/PrtCalloc calls made by the calling
+	* thread since it started. Intended for benchmarking and diagnostics;
+	* the counter is thread-local, so allocations made by other threads are
+	* not observed.
+	* @returns The calling thread's allocation count.
+	*/
+	PRT_API PRT_UINT64 PRT_CALL_CONV PrtGetAllocationCount(void);
+
 #ifdef __cplusplus
 }
 #endif
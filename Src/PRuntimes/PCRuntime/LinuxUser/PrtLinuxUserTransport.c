@@ -0,0 +1,55 @@
+#include "PrtLinuxUserConfig.h"
+#include "Prt.h"
+#include "PrtTransport.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+// Shared-memory mapping hooks for the transport (see PrtTransport.h). The
+// ring of a process is a POSIX shared-memory object named after its guid, so
+// any process on the host that knows the guid can open it.
+
+static void PrtTransportRingName(PRT_GUID processId, char* name, size_t size)
+{
+  snprintf(name, size, "/prt-%08x-%04x-%04x-%016llx",
+    processId.data1, processId.data2, processId.data3,
+    (unsigned long long)processId.data4);
+}
+
+void* PrtTransportMapRing(_In_ PRT_GUID processId, _In_ PRT_UINT32 ringBytes, _In_ PRT_BOOLEAN create)
+{
+  char name[64];
+  PrtTransportRingName(processId, name, sizeof(name));
+  int flags = create == PRT_TRUE ? O_RDWR | O_CREAT : O_RDWR;
+  int fd = shm_open(name, flags, 0600);
+  if (fd < 0)
+  {
+    return NULL;
+  }
+  if (create == PRT_TRUE && ftruncate(fd, ringBytes) != 0)
+  {
+    close(fd);
+    shm_unlink(name);
+    return NULL;
+  }
+  void* ring = mmap(NULL, ringBytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (ring == MAP_FAILED)
+  {
+    return NULL;
+  }
+  return ring;
+}
+
+void PrtTransportUnmapRing(_In_ void* ring, _In_ PRT_UINT32 ringBytes, _In_ PRT_GUID processId, _In_ PRT_BOOLEAN owner)
+{
+  munmap(ring, ringBytes);
+  if (owner == PRT_TRUE)
+  {
+    char name[64];
+    PrtTransportRingName(processId, name, sizeof(name));
+    shm_unlink(name);
+  }
+}
@@ -27,6 +27,9 @@ extern "C"{
 
 #define FORCEINLINE
 
+    /** Thread-local storage */
+#define PRT_THREAD_LOCAL __thread
+
     /** Linking method */
 #ifdef PRT_API_IMPL
 #define PRT_API __declspec(dllexport)
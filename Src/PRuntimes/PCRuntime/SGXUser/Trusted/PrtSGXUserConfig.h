@@ -21,6 +21,8 @@ extern "C"{
     /** Calling convention */
 #define PRT_CALL_CONV
 
+    /** Thread-local storage */
+#define PRT_THREAD_LOCAL __thread
 
     /** Linking method */
 #ifdef PRT_API_IMPL
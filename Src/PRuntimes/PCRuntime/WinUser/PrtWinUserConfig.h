@@ -12,6 +12,9 @@ extern "C" {
 	/** Calling convention */
 #define PRT_CALL_CONV __cdecl
 
+	/** Thread-local storage */
+#define PRT_THREAD_LOCAL __declspec(thread)
+
 /** Linking method */
 #ifdef PRT_API_IMPL
 #define PRT_API __declspec(dllexport)
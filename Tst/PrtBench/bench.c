@@ -0,0 +1,279 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "Prt.h"
+
+/*
+ * PrtBench: microbenchmarks for the hot paths of the P C runtime.
+ *
+ * Unlike PrtTester, this driver does not depend on code generated by the P
+ * compiler; it hand-writes a minimal program declaration (two machines, one
+ * user event) so the machine-creation and send/dequeue benchmarks can run
+ * against an unmodified runtime. Each benchmark reports nanoseconds per
+ * operation and allocations per operation (see PrtGetAllocationCount).
+ */
+
+#define BENCH_EVENT_PING 2
+
+static PRT_TYPE benchIntType =
+{
+	PRT_KIND_INT,
+	{(struct PRT_MAPTYPE *)NULL}
+};
+
+static PRT_EVENTDECL benchEventPing =
+{
+	{
+		PRT_VALUE_KIND_EVENT,
+		{.ev = BENCH_EVENT_PING}
+	},
+	"BENCH_PING",
+	4294967295U,
+	&benchIntType
+};
+
+static PRT_EVENTDECL* benchEvents[] = { &_P_EVENT_NULL_STRUCT, &_P_EVENT_HALT_STRUCT, &benchEventPing };
+
+static PRT_EVENTSETDECL benchEmptySet = { 0, NULL, NULL };
+
+static PRT_EVENTDECL* benchPingEvents[] = { &benchEventPing };
+static PRT_EVENTSETDECL benchDoSet = { 1, benchPingEvents, NULL };
+static PRT_EVENTSETDECL benchTransSet = { 1, benchPingEvents, NULL };
+
+static PRT_EVENTDECL* benchRecvEvents[] = { &_P_EVENT_NULL_STRUCT, &_P_EVENT_HALT_STRUCT, &benchEventPing };
+static PRT_EVENTSETDECL benchRecvSet = { 3, benchRecvEvents, NULL };
+
+/* Machine "Main": a single state that absorbs BENCH_PING with a no-op do
+ * handler, so a send measures enqueue + dequeue + handler dispatch only. */
+static PRT_DODECL benchMainDos[] =
+{
+	{ 0, &benchEventPing, &_P_NO_OP }
+};
+
+static PRT_STATEDECL benchMainStates[] =
+{
+	{ "Init", 0, 1, &benchEmptySet, &benchEmptySet, &benchDoSet, NULL, benchMainDos, &_P_NO_OP, &_P_NO_OP, NULL, NULL }
+};
+
+static PRT_MACHINEDECL benchMainMachine =
+{
+	0, "Main", &benchRecvSet, &benchRecvSet, NULL, 0, 1, 0, 4294967295U, 0, NULL, benchMainStates, NULL
+};
+
+/* Machine "Flip": two states that transition to each other on BENCH_PING, so
+ * a send additionally measures exit/entry handlers and the state change. */
+static PRT_TRANSDECL benchFlipTransA[] =
+{
+	{ 0, &benchEventPing, 1, &_P_NO_OP }
+};
+
+static PRT_TRANSDECL benchFlipTransB[] =
+{
+	{ 1, &benchEventPing, 0, &_P_NO_OP }
+};
+
+static PRT_STATEDECL benchFlipStates[] =
+{
+	{ "FlipA", 1, 0, &benchEmptySet, &benchTransSet, &benchEmptySet, benchFlipTransA, NULL, &_P_NO_OP, &_P_NO_OP, NULL, NULL },
+	{ "FlipB", 1, 0, &benchEmptySet, &benchTransSet, &benchEmptySet, benchFlipTransB, NULL, &_P_NO_OP, &_P_NO_OP, NULL, NULL }
+};
+
+static PRT_MACHINEDECL benchFlipMachine =
+{
+	1, "Flip", &benchRecvSet, &benchRecvSet, NULL, 0, 2, 0, 4294967295U, 0, NULL, benchFlipStates, NULL
+};
+
+static PRT_MACHINEDECL* benchMachines[] = { &benchMainMachine, &benchFlipMachine };
+
+static PRT_INTERFACEDECL benchMainInterface = { 0, "Main", &benchIntType, &benchRecvSet };
+static PRT_INTERFACEDECL benchFlipInterface = { 1, "Flip", &benchIntType, &benchRecvSet };
+static PRT_INTERFACEDECL* benchInterfaces[] = { &benchMainInterface, &benchFlipInterface };
+
+static PRT_UINT32 benchLinkMapRow0[] = { 0, 1 };
+static PRT_UINT32 benchLinkMapRow1[] = { 0, 1 };
+static PRT_UINT32* benchLinkMap[] = { benchLinkMapRow0, benchLinkMapRow1 };
+static PRT_UINT32 benchInterfaceDefMap[] = { 0, 1 };
+
+static PRT_PROGRAMDECL benchProgram =
+{
+	3, 2, 2, 0, 0,
+	benchEvents, benchMachines, benchInterfaces, NULL, NULL,
+	benchLinkMap, benchInterfaceDefMap
+};
+
+static void ErrorHandler(PRT_STATUS status, PRT_MACHINEINST* ptr)
+{
+	fprintf(stdout, "exiting with PRT_STATUS %d\n", (int)status);
+	exit(1);
+}
+
+static void Log(PRT_STEP step, PRT_MACHINESTATE* senderState, PRT_MACHINEINST* receiver, PRT_VALUE* event, PRT_VALUE* payload)
+{
+	// Logging is deliberately a no-op: the benchmarks measure the runtime,
+	// not the console.
+}
+
+static PRT_UINT64 BenchNow(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (PRT_UINT64)ts.tv_sec * 1000000000ULL + (PRT_UINT64)ts.tv_nsec;
+}
+
+static void BenchReport(const char* name, PRT_UINT64 elapsedNs, PRT_UINT64 allocs, PRT_UINT64 ops)
+{
+	printf("%-32s %10.1f ns/op %8.2f allocs/op  (%llu ops)\n",
+		name, (double)elapsedNs / (double)ops, (double)allocs / (double)ops,
+		(unsigned long long)ops);
+}
+
+static void BenchSendPing(PRT_MACHINEINST* machine, PRT_UINT64 ops)
+{
+	for (PRT_UINT64 i = 0; i < ops; i++)
+	{
+		PRT_VALUE* payload = PrtMkIntValue((PRT_INT)i);
+		PRT_VALUE* event = PrtMkEventValue(BENCH_EVENT_PING);
+		PrtSend(NULL, machine, event, 1, &payload);
+	}
+}
+
+/** A send under the default task-neutral policy enqueues the event and runs
+* the receiving machine to completion on the calling thread, so each
+* iteration is one full enqueue/dequeue/handler round trip. */
+static void BenchSendRoundTrip(PRT_MACHINEINST* machine, const char* name, PRT_UINT64 ops)
+{
+	BenchSendPing(machine, ops / 10);
+	const PRT_UINT64 allocs0 = PrtGetAllocationCount();
+	const PRT_UINT64 start = BenchNow();
+	BenchSendPing(machine, ops);
+	BenchReport(name, BenchNow() - start, PrtGetAllocationCount() - allocs0, ops);
+}
+
+static void BenchMachineCreation(PRT_PROCESS* process, PRT_UINT64 ops)
+{
+	const PRT_UINT64 allocs0 = PrtGetAllocationCount();
+	const PRT_UINT64 start = BenchNow();
+	for (PRT_UINT64 i = 0; i < ops; i++)
+	{
+		PrtMkMachine(process, 0, 0);
+	}
+	BenchReport("PrtMkMachine", BenchNow() - start, PrtGetAllocationCount() - allocs0, ops);
+}
+
+/** Builds (((int, map[int,int]), map[int,int])) with 32 entries per map. */
+static PRT_VALUE* BenchMkNestedValue(void)
+{
+	PRT_TYPE* intType = PrtMkPrimitiveType(PRT_KIND_INT);
+	PRT_TYPE* mapType = PrtMkMapType(intType, intType);
+	PRT_TYPE* innerType = PrtMkTupType(2);
+	PrtSetFieldType(innerType, 0, intType);
+	PrtSetFieldType(innerType, 1, mapType);
+	PRT_TYPE* outerType = PrtMkTupType(2);
+	PrtSetFieldType(outerType, 0, innerType);
+	PrtSetFieldType(outerType, 1, mapType);
+
+	PRT_VALUE* map = PrtMkDefaultValue(mapType);
+	for (PRT_INT i = 0; i < 32; i++)
+	{
+		PRT_VALUE* key = PrtMkIntValue(i);
+		PRT_VALUE* val = PrtMkIntValue(i * 7);
+		PrtMapUpdate(map, key, val);
+		PrtFreeValue(key);
+		PrtFreeValue(val);
+	}
+
+	PRT_VALUE* inner = PrtMkDefaultValue(innerType);
+	PrtTupleSet(inner, 1, map);
+	PRT_VALUE* outer = PrtMkDefaultValue(outerType);
+	PrtTupleSet(outer, 0, inner);
+	PrtTupleSet(outer, 1, map);
+
+	PrtFreeValue(inner);
+	PrtFreeValue(map);
+	PrtFreeType(outerType);
+	PrtFreeType(innerType);
+	PrtFreeType(mapType);
+	PrtFreeType(intType);
+	return outer;
+}
+
+static void BenchCloneNested(PRT_UINT64 ops)
+{
+	PRT_VALUE* value = BenchMkNestedValue();
+	const PRT_UINT64 allocs0 = PrtGetAllocationCount();
+	const PRT_UINT64 start = BenchNow();
+	for (PRT_UINT64 i = 0; i < ops; i++)
+	{
+		PRT_VALUE* clone = PrtCloneValue(value);
+		PrtFreeValue(clone);
+	}
+	BenchReport("PrtCloneValue (nested)", BenchNow() - start, PrtGetAllocationCount() - allocs0, ops);
+	PrtFreeValue(value);
+}
+
+static void BenchMapOps(PRT_UINT32 size, PRT_UINT64 ops)
+{
+	char name[64];
+	PRT_TYPE* intType = PrtMkPrimitiveType(PRT_KIND_INT);
+	PRT_TYPE* mapType = PrtMkMapType(intType, intType);
+	PRT_VALUE* map = PrtMkDefaultValue(mapType);
+	for (PRT_UINT32 i = 0; i < size; i++)
+	{
+		PRT_VALUE* key = PrtMkIntValue((PRT_INT)i);
+		PRT_VALUE* val = PrtMkIntValue((PRT_INT)i);
+		PrtMapUpdate(map, key, val);
+		PrtFreeValue(key);
+		PrtFreeValue(val);
+	}
+
+	PRT_UINT64 allocs0 = PrtGetAllocationCount();
+	PRT_UINT64 start = BenchNow();
+	for (PRT_UINT64 i = 0; i < ops; i++)
+	{
+		PRT_VALUE* key = PrtMkIntValue((PRT_INT)(i % size));
+		PRT_VALUE* val = PrtMapGet(map, key);
+		PrtFreeValue(val);
+		PrtFreeValue(key);
+	}
+	snprintf(name, sizeof(name), "PrtMapGet [%u]", (unsigned)size);
+	BenchReport(name, BenchNow() - start, PrtGetAllocationCount() - allocs0, ops);
+
+	allocs0 = PrtGetAllocationCount();
+	start = BenchNow();
+	for (PRT_UINT64 i = 0; i < ops; i++)
+	{
+		PRT_VALUE* key = PrtMkIntValue((PRT_INT)(i % size));
+		PRT_VALUE* val = PrtMkIntValue((PRT_INT)i);
+		PrtMapUpdate(map, key, val);
+		PrtFreeValue(val);
+		PrtFreeValue(key);
+	}
+	snprintf(name, sizeof(name), "PrtMapUpdate [%u]", (unsigned)size);
+	BenchReport(name, BenchNow() - start, PrtGetAllocationCount() - allocs0, ops);
+
+	PrtFreeValue(map);
+	PrtFreeType(mapType);
+	PrtFreeType(intType);
+}
+
+int main(int argc, char* argv[])
+{
+	PRT_GUID processGuid = { 1, 0, 0, 0 };
+	PRT_PROCESS* process = PrtStartProcess(processGuid, &benchProgram, ErrorHandler, Log);
+
+	PRT_VALUE* payload = PrtMkIntValue(0);
+	PRT_MACHINEINST* mainMachine = PrtMkMachine(process, 0, 1, &payload);
+	PRT_VALUE* flipPayload = PrtMkIntValue(0);
+	PRT_MACHINEINST* flipMachine = PrtMkMachine(process, 1, 1, &flipPayload);
+
+	BenchSendRoundTrip(mainMachine, "PrtSend round trip", 500000);
+	BenchSendRoundTrip(flipMachine, "PrtSend + state transition", 500000);
+	BenchMachineCreation(process, 50000);
+	BenchCloneNested(100000);
+	BenchMapOps(64, 500000);
+	BenchMapOps(1024, 500000);
+	BenchMapOps(65536, 500000);
+
+	PrtStopProcess(process);
+	return 0;
+}